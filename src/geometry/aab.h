@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <iostream>
 #include <vector>
+#include <algorithm>
 #include <float.h>
 #include <math.h>
 #include <immintrin.h>
@@ -168,6 +169,17 @@ public:
 		return ret;
 	}
 
+	// the squared distance between the farthest corners, an upper
+	// bound of the distance between any objects in the two boxes
+	float max_distance(const aab &b){
+		float ret = 0;
+		for(int i=0;i<3;i++){
+			float tmp = std::max(max[i]-b.min[i], b.max[i]-min[i]);
+			ret += tmp*tmp;
+		}
+		return ret;
+	}
+
 	range distance(const aab &b){
 		range ret;
 		float tmp1 = 0;
@@ -0,0 +1,216 @@
+/*
+ * bvh.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <float.h>
+#include <assert.h>
+#include <algorithm>
+#include "bvh.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace hispeed{
+
+// max number of segments in a leaf
+const static unsigned int BVH_LEAF_SIZE = 8;
+// number of segments evaluated together
+const static unsigned int BVH_LANES = 4;
+
+segment_bvh::segment_bvh(const float *segments, size_t num){
+	assert(segments||num==0);
+	if(num==0){
+		return;
+	}
+	vector<unsigned int> order(num);
+	vector<float> centers(3*num);
+	for(size_t i=0;i<num;i++){
+		order[i] = i;
+		for(int t=0;t<3;t++){
+			centers[3*i+t] = (segments[6*i+t]+segments[6*i+3+t])/2;
+		}
+	}
+	nodes.reserve(2*(num/BVH_LEAF_SIZE+1));
+	nodes.push_back(bvh_node());
+	build(0, segments, order, centers, 0, num);
+
+	// lay the segments out in the order of the leaves, each leaf
+	// is padded to the SIMD width by repeating its last segment
+	size_t padded = 0;
+	for(bvh_node &node:nodes){
+		if(node.count>0){
+			padded += (node.count+BVH_LANES-1)/BVH_LANES*BVH_LANES;
+		}
+	}
+	px.reserve(padded);
+	py.reserve(padded);
+	pz.reserve(padded);
+	dx.reserve(padded);
+	dy.reserve(padded);
+	dz.reserve(padded);
+	inv_len.reserve(padded);
+	for(bvh_node &node:nodes){
+		if(node.count==0){
+			continue;
+		}
+		const unsigned int first = node.first;
+		node.first = px.size();
+		for(unsigned int i=0;i<node.count;i++){
+			add_segment(segments+6*order[first+i]);
+		}
+		while(px.size()%BVH_LANES!=0){
+			add_segment(segments+6*order[first+node.count-1]);
+		}
+	}
+	assert(px.size()==padded);
+	this->num = num;
+}
+
+void segment_bvh::add_segment(const float *s){
+	px.push_back(s[0]);
+	py.push_back(s[1]);
+	pz.push_back(s[2]);
+	dx.push_back(s[3]-s[0]);
+	dy.push_back(s[4]-s[1]);
+	dz.push_back(s[5]-s[2]);
+	float len = dx.back()*dx.back()+dy.back()*dy.back()+dz.back()*dz.back();
+	inv_len.push_back(len>0?1.0/len:0);
+}
+
+void segment_bvh::build(unsigned int n, const float *segments, vector<unsigned int> &order,
+		vector<float> &centers, unsigned int begin, unsigned int end){
+	bvh_node node;
+	for(int t=0;t<3;t++){
+		node.min[t] = FLT_MAX;
+		node.max[t] = -FLT_MAX;
+	}
+	// the box of the segments and of their centers
+	float cmin[3] = {FLT_MAX, FLT_MAX, FLT_MAX};
+	float cmax[3] = {-FLT_MAX, -FLT_MAX, -FLT_MAX};
+	for(unsigned int i=begin;i<end;i++){
+		const float *s = segments+6*order[i];
+		for(int t=0;t<3;t++){
+			node.min[t] = std::min(node.min[t], std::min(s[t], s[3+t]));
+			node.max[t] = std::max(node.max[t], std::max(s[t], s[3+t]));
+			cmin[t] = std::min(cmin[t], centers[3*order[i]+t]);
+			cmax[t] = std::max(cmax[t], centers[3*order[i]+t]);
+		}
+	}
+	if(end-begin<=BVH_LEAF_SIZE){
+		node.first = begin;
+		node.count = end-begin;
+		nodes[n] = node;
+		return;
+	}
+	// split at the median of the longest axis
+	int axis = 0;
+	for(int t=1;t<3;t++){
+		if(cmax[t]-cmin[t]>cmax[axis]-cmin[axis]){
+			axis = t;
+		}
+	}
+	unsigned int mid = (begin+end)/2;
+	std::nth_element(order.begin()+begin, order.begin()+mid, order.begin()+end,
+			[&centers, axis](unsigned int a, unsigned int b){
+		return centers[3*a+axis]<centers[3*b+axis];
+	});
+	node.first = nodes.size();
+	node.count = 0;
+	nodes[n] = node;
+	nodes.push_back(bvh_node());
+	nodes.push_back(bvh_node());
+	build(node.first, segments, order, centers, begin, mid);
+	build(node.first+1, segments, order, centers, mid, end);
+}
+
+float segment_bvh::box_distance(const bvh_node &node, const float *point){
+	float dist = 0;
+	for(int t=0;t<3;t++){
+		float d = std::max(std::max(node.min[t]-point[t], point[t]-node.max[t]), (float)0);
+		dist += d*d;
+	}
+	return dist;
+}
+
+// the squared distance from point to the nearest segment in a leaf
+float segment_bvh::leaf_distance(const bvh_node &node, const float *point){
+	const unsigned int end = node.first+(node.count+BVH_LANES-1)/BVH_LANES*BVH_LANES;
+#ifdef __SSE2__
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1);
+	const __m128 x = _mm_set1_ps(point[0]);
+	const __m128 y = _mm_set1_ps(point[1]);
+	const __m128 z = _mm_set1_ps(point[2]);
+	__m128 best = _mm_set1_ps(FLT_MAX);
+	for(unsigned int i=node.first;i<end;i+=BVH_LANES){
+		__m128 vx = _mm_loadu_ps(&dx[i]);
+		__m128 vy = _mm_loadu_ps(&dy[i]);
+		__m128 vz = _mm_loadu_ps(&dz[i]);
+		__m128 tx = _mm_sub_ps(x, _mm_loadu_ps(&px[i]));
+		__m128 ty = _mm_sub_ps(y, _mm_loadu_ps(&py[i]));
+		__m128 tz = _mm_sub_ps(z, _mm_loadu_ps(&pz[i]));
+		// the projection on the segment, clamped to its end points
+		__m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, vx), _mm_mul_ps(ty, vy)), _mm_mul_ps(tz, vz));
+		t = _mm_mul_ps(t, _mm_loadu_ps(&inv_len[i]));
+		t = _mm_min_ps(_mm_max_ps(t, zero), one);
+		__m128 ex = _mm_sub_ps(tx, _mm_mul_ps(t, vx));
+		__m128 ey = _mm_sub_ps(ty, _mm_mul_ps(t, vy));
+		__m128 ez = _mm_sub_ps(tz, _mm_mul_ps(t, vz));
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, ex), _mm_mul_ps(ey, ey)), _mm_mul_ps(ez, ez));
+		best = _mm_min_ps(best, d);
+	}
+	float dist[BVH_LANES];
+	_mm_storeu_ps(dist, best);
+	return std::min(std::min(dist[0], dist[1]), std::min(dist[2], dist[3]));
+#else
+	float best = FLT_MAX;
+	for(unsigned int i=node.first;i<end;i++){
+		float tx = point[0]-px[i];
+		float ty = point[1]-py[i];
+		float tz = point[2]-pz[i];
+		float t = (tx*dx[i]+ty*dy[i]+tz*dz[i])*inv_len[i];
+		t = std::min(std::max(t, (float)0), (float)1);
+		float ex = tx-t*dx[i];
+		float ey = ty-t*dy[i];
+		float ez = tz-t*dz[i];
+		best = std::min(best, ex*ex+ey*ey+ez*ez);
+	}
+	return best;
+#endif
+}
+
+float segment_bvh::nearest(const float *point, float bound){
+	if(nodes.empty()){
+		return bound;
+	}
+	float best = bound;
+	// the depth is bounded by the median splits
+	unsigned int stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while(top>0){
+		const bvh_node &node = nodes[stack[--top]];
+		if(box_distance(node, point)>=best){
+			continue;
+		}
+		if(node.count>0){
+			best = std::min(best, leaf_distance(node, point));
+			continue;
+		}
+		// visit the nearer child first
+		unsigned int near = node.first;
+		unsigned int far = node.first+1;
+		if(box_distance(nodes[far], point)<box_distance(nodes[near], point)){
+			std::swap(near, far);
+		}
+		assert(top+2<=64);
+		stack[top++] = far;
+		stack[top++] = near;
+	}
+	return best;
+}
+
+}
@@ -0,0 +1,64 @@
+/*
+ * bvh.h
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  a bounding volume hierarchy over the segments of a mesh,
+ *  stored in flat arrays of floats. The nodes are split at
+ *  the median of the longest axis, and the segments of each
+ *  leaf are kept in separate coordinate arrays such that the
+ *  point-segment distances of a leaf are computed with SIMD
+ *  instructions, four segments at a time.
+ *
+ */
+
+#ifndef HISPEED_BVH_H_
+#define HISPEED_BVH_H_
+
+#include <vector>
+#include <stddef.h>
+
+using namespace std;
+
+namespace hispeed{
+
+class segment_bvh{
+	typedef struct bvh_node_{
+		float min[3];
+		float max[3];
+		// the left child (the right one follows) of an inner node,
+		// or the first segment of a leaf
+		unsigned int first;
+		// number of segments in a leaf, 0 for inner nodes
+		unsigned int count;
+	}bvh_node;
+
+	vector<bvh_node> nodes;
+	// the starting points and directions of the segments in
+	// the order of the leaves, and the inverse of the squared
+	// lengths (0 for the degenerated ones)
+	vector<float> px, py, pz;
+	vector<float> dx, dy, dz;
+	vector<float> inv_len;
+	size_t num = 0;
+
+	void build(unsigned int n, const float *segments, vector<unsigned int> &order,
+			vector<float> &centers, unsigned int begin, unsigned int end);
+	void add_segment(const float *s);
+	float box_distance(const bvh_node &node, const float *point);
+	float leaf_distance(const bvh_node &node, const float *point);
+public:
+	// segments are given as 6 floats each
+	segment_bvh(const float *segments, size_t num);
+	// the squared distance from point to the nearest segment,
+	// the nodes not nearer than bound are not visited, and
+	// bound is returned if no segment is nearer
+	float nearest(const float *point, float bound);
+	size_t num_segments(){
+		return num;
+	}
+};
+
+}
+
+#endif /* HISPEED_BVH_H_ */
@@ -7,6 +7,7 @@
 #include <float.h>
 #include "./mygpu.h"
 #include "../util/util.h"
+#include "../util/task_pool.h"
 #include "pthread.h"
 using namespace std;
 
@@ -118,14 +119,45 @@ void SegDist_batch_gpu(gpu_info *gpu, const float *data, const uint *offset_size
 bool TriInt(const float *data1, const float *data2);
 bool TriInt_single(const float *data1, const float *data2, size_t size1, size_t size2);
 
+// a request waiting to be computed in a batch
+typedef struct batch_request_{
+	geometry_param *param;
+	bool intersect;
+	bool done;
+	// waited by the requester in the pool
+	task_group group;
+}batch_request;
+
 class geometry_computer{
 	pthread_mutex_t gpu_lock;
 	pthread_mutex_t cpu_lock;
 	int max_thread_num = hispeed::get_num_threads();
-	bool cpu_busy = false;
 	bool gpu_busy = false;
-	bool request_cpu();
-	void release_cpu();
+	// run the kernels as tasks in the pool if set, such that
+	// the computations of concurrent joins are interleaved
+	// instead of taking the CPU in turn
+	task_pool *pool = NULL;
+	void run_cpu(vector<geometry_param *> &ccs, task_func unit, bool intersect);
+
+	// the requests of concurrent joins are coalesced into one
+	// dispatch if batch_pairs is not 0. The first request waits
+	// up to batch_wait microseconds for the others unless batch_pairs
+	// pairs are pending, and then computes all the pending ones
+	size_t batch_pairs = 0;
+	int batch_wait = 1000;
+	pthread_mutex_t batch_lock;
+	pthread_cond_t batch_cond;
+	vector<batch_request *> pending;
+	size_t pending_pairs = 0;
+	bool dispatching = false;
+	// a request is collecting the next batch in the pool
+	bool collecting = false;
+	void submit(geometry_param &cc, bool intersect);
+	void submit_pool(batch_request &r);
+	vector<batch_request *> take_pending();
+	void dispatch(vector<batch_request *> &requests);
+	void compute(vector<geometry_param *> &ccs, bool intersect);
+	void compute_gpu(vector<geometry_param *> &ccs, size_t begin, size_t end);
 	gpu_info *request_gpu(int min_size, bool force=false);
 	void release_gpu(gpu_info *info);
 
@@ -134,9 +166,14 @@ class geometry_computer{
 
 public:
 	~geometry_computer();
+	size_t dispatches = 0;
+	size_t batched = 0;
+
 	geometry_computer(){
 		pthread_mutex_init(&cpu_lock, NULL);
 		pthread_mutex_init(&gpu_lock, NULL);
+		pthread_mutex_init(&batch_lock, NULL);
+		pthread_cond_init(&batch_cond, NULL);
 	}
 
 	bool init_gpus();
@@ -148,6 +185,15 @@ public:
 	void set_thread_num(uint num){
 		max_thread_num = num;
 	}
+	void set_pool(task_pool *p){
+		pool = p;
+	}
+	void set_batching(size_t pairs, int wait){
+		assert(wait>=0);
+		batch_pairs = pairs;
+		batch_wait = wait;
+	}
+	void report();
 };
 
 
@@ -5,6 +5,7 @@
  *      Author: teng
  */
 
+#include <limits.h>
 #include "./geometry.h"
 #include "./mygpu.h"
 
@@ -21,23 +22,6 @@ void *SegDist_unit(void *params_void){
 	}
 	return NULL;
 }
-bool geometry_computer::request_cpu(){
-	if(cpu_busy==false){
-		pthread_mutex_lock(&cpu_lock);
-		if(cpu_busy==false){
-			cpu_busy = true;
-			return true;
-		}else{
-			pthread_mutex_unlock(&cpu_lock);
-		}
-	}
-	return false;
-}
-void geometry_computer::release_cpu(){
-	assert(cpu_busy);
-	cpu_busy = false;
-	pthread_mutex_unlock(&cpu_lock);
-}
 gpu_info *geometry_computer::request_gpu(int min_size, bool force){
 	do{
 		for(gpu_info *info:gpus){
@@ -74,32 +58,63 @@ bool geometry_computer::init_gpus(){
 	return true;
 }
 
-void geometry_computer::get_distance_cpu(geometry_param &cc){
-	while(!request_cpu()){
-		usleep(10);
-	}
-	pthread_t threads[max_thread_num];
-	geometry_param params[max_thread_num];
-	int each_thread = cc.pair_num/max_thread_num;
-	for(int i=0;i<max_thread_num;i++){
-		int start = each_thread*i;
-		if(start>=cc.pair_num){
-			break;
+// split the pairs of the requests into units computed by multiple
+// threads, or by the tasks in the pool
+void geometry_computer::run_cpu(vector<geometry_param *> &ccs, task_func unit, bool intersect){
+	int num_units = max_thread_num;
+	if(pool!=NULL){
+		// smaller units for balancing the load with the
+		// units of the other joins
+		num_units = 4*pool->num_threads();
+	}
+	size_t total = 0;
+	for(geometry_param *cc:ccs){
+		total += cc->pair_num;
+	}
+	int each_unit = std::max(1, (int)((total+num_units-1)/num_units));
+	vector<geometry_param> params;
+	for(geometry_param *cc:ccs){
+		for(int start=0;start<cc->pair_num;start+=each_unit){
+			geometry_param p = *cc;
+			p.pair_num = min(each_unit, (int)cc->pair_num-start);
+			p.offset_size = cc->offset_size+start*4;
+			p.id = params.size()+1;
+			if(intersect){
+				p.intersect = cc->intersect+start;
+			}else{
+				p.distances = cc->distances+start;
+			}
+			params.push_back(p);
+		}
+	}
+	if(params.empty()){
+		return;
+	}
+	if(pool!=NULL){
+		task_group group;
+		for(geometry_param &p:params){
+			pool->submit(group, unit, (void *)&p);
 		}
-		params[i] = cc;
-		params[i].pair_num = min(each_thread, (int)cc.pair_num-start);
-		params[i].offset_size = cc.offset_size+start*4;
-		params[i].data = cc.data;
-		params[i].id = i+1;
-		params[i].distances = cc.distances+start;
-		pthread_create(&threads[i], NULL, SegDist_unit, (void *)&params[i]);
-	}
-	log("%d threads started to get distance", max_thread_num);
-	for(int i = 0; i < max_thread_num; i++){
+		pool->wait(group);
+		return;
+	}
+	pthread_mutex_lock(&cpu_lock);
+	pthread_t threads[params.size()];
+	for(size_t i=0;i<params.size();i++){
+		pthread_create(&threads[i], NULL, unit, (void *)&params[i]);
+	}
+	log("%ld threads started", params.size());
+	for(size_t i=0;i<params.size();i++){
 		void *status;
 		pthread_join(threads[i], &status);
 	}
-	release_cpu();
+	pthread_mutex_unlock(&cpu_lock);
+}
+
+void geometry_computer::get_distance_cpu(geometry_param &cc){
+	vector<geometry_param *> ccs;
+	ccs.push_back(&cc);
+	run_cpu(ccs, SegDist_unit, false);
 }
 
 void geometry_computer::get_distance_gpu(geometry_param &cc){
@@ -111,11 +126,13 @@ void geometry_computer::get_distance_gpu(geometry_param &cc){
 }
 
 void geometry_computer::get_distance(geometry_param &cc){
-	if(gpus.size()>0){
-		get_distance_gpu(cc);
-	}else{
-		get_distance_cpu(cc);
+	if(batch_pairs>0){
+		submit(cc, false);
+		return;
 	}
+	vector<geometry_param *> ccs;
+	ccs.push_back(&cc);
+	compute(ccs, false);
 }
 
 void *TriInt_unit(void *params_void){
@@ -130,33 +147,217 @@ void *TriInt_unit(void *params_void){
 }
 
 void geometry_computer::get_intersect(geometry_param &cc){
-	while(!request_cpu()){
-		usleep(10);;
-	}
-
-	// compute the minimum distance of segment pairs with multiple threads
-	pthread_t threads[max_thread_num];
-	geometry_param params[max_thread_num];
-	int each_thread = cc.pair_num/max_thread_num;
-	for(int i=0;i<max_thread_num;i++){
-		int start = each_thread*i;
-		if(start>=cc.pair_num){
-			break;
+	if(batch_pairs>0){
+		submit(cc, true);
+		return;
+	}
+	vector<geometry_param *> ccs;
+	ccs.push_back(&cc);
+	compute(ccs, true);
+}
+
+// compute the requests of the same kind in one dispatch
+void geometry_computer::compute(vector<geometry_param *> &ccs, bool intersect){
+	if(ccs.empty()){
+		return;
+	}
+	__sync_fetch_and_add(&dispatches, 1);
+	if(intersect){
+		run_cpu(ccs, TriInt_unit, true);
+		return;
+	}
+	if(gpus.size()==0){
+		run_cpu(ccs, SegDist_unit, false);
+		return;
+	}
+	// the requests are computed together in chunks whose data
+	// and pairs can be addressed with the uint offsets of the kernel
+	size_t begin = 0;
+	while(begin<ccs.size()){
+		size_t data_size = 0;
+		size_t pair_num = 0;
+		size_t end = begin;
+		while(end<ccs.size()){
+			if(end>begin&&(data_size+ccs[end]->data_size>UINT_MAX||
+						   4*(pair_num+ccs[end]->pair_num)>UINT_MAX)){
+				break;
+			}
+			data_size += ccs[end]->data_size;
+			pair_num += ccs[end]->pair_num;
+			end++;
 		}
-		params[i].pair_num = min(each_thread, (int)cc.pair_num-start);
-		params[i].offset_size = cc.offset_size+start*4;
-		params[i].data = cc.data;
-		params[i].id = i+1;
-		params[i].intersect = cc.intersect+start;
-		pthread_create(&threads[i], NULL, TriInt_unit, (void *)&params[i]);
-	}
-	log("%d threads started", max_thread_num);
-	for(int i = 0; i < max_thread_num; i++){
-		void *status;
-		pthread_join(threads[i], &status);
+		if(end-begin==1){
+			get_distance_gpu(*ccs[begin]);
+		}else{
+			compute_gpu(ccs, begin, end);
+		}
+		begin = end;
 	}
-	release_cpu();
 }
 
+// the data of the requests in [begin, end) are copied into one buffer
+// for the GPU, with the offsets rebased and the distances scattered back
+void geometry_computer::compute_gpu(vector<geometry_param *> &ccs, size_t begin, size_t end){
+	geometry_param gp;
+	gp.pair_num = 0;
+	gp.data_size = 0;
+	for(size_t i=begin;i<end;i++){
+		gp.pair_num += ccs[i]->pair_num;
+		gp.data_size += ccs[i]->data_size;
+	}
+	float *data = new float[(size_t)gp.data_size*6];
+	uint *offset_size = new uint[4*(size_t)gp.pair_num];
+	float *distances = new float[gp.pair_num];
+	size_t data_base = 0;
+	size_t pair_base = 0;
+	for(size_t c=begin;c<end;c++){
+		geometry_param *cc = ccs[c];
+		memcpy(data+data_base*6, cc->data, (size_t)cc->data_size*6*sizeof(float));
+		for(uint i=0;i<cc->pair_num;i++){
+			uint *os = offset_size+4*(pair_base+i);
+			os[0] = cc->offset_size[4*i]+data_base;
+			os[1] = cc->offset_size[4*i+1];
+			os[2] = cc->offset_size[4*i+2]+data_base;
+			os[3] = cc->offset_size[4*i+3];
+		}
+		data_base += cc->data_size;
+		pair_base += cc->pair_num;
+	}
+	gp.data = data;
+	gp.offset_size = offset_size;
+	gp.distances = distances;
+	get_distance_gpu(gp);
+	pair_base = 0;
+	for(size_t c=begin;c<end;c++){
+		memcpy(ccs[c]->distances, distances+pair_base, ccs[c]->pair_num*sizeof(float));
+		pair_base += ccs[c]->pair_num;
+	}
+	delete []data;
+	delete []offset_size;
+	delete []distances;
+}
+
+void geometry_computer::dispatch(vector<batch_request *> &requests){
+	vector<geometry_param *> distance_ccs;
+	vector<geometry_param *> intersect_ccs;
+	for(batch_request *r:requests){
+		(r->intersect?intersect_ccs:distance_ccs).push_back(r->param);
+	}
+	compute(distance_ccs, false);
+	compute(intersect_ccs, true);
+}
+
+// take all the pending requests, with batch_lock held
+vector<batch_request *> geometry_computer::take_pending(){
+	vector<batch_request *> requests;
+	requests.swap(pending);
+	pending_pairs = 0;
+	batched += requests.size();
+	return requests;
 }
 
+/*
+ * the requests are computed in batches. A request arriving when no
+ * batch is being computed leads the next batch: it waits a while for
+ * the requests of the other joins unless enough pairs are pending,
+ * and then computes all the pending ones. The others wait until
+ * their requests are computed by a leader.
+ * */
+void geometry_computer::submit(geometry_param &cc, bool intersect){
+	batch_request r;
+	r.param = &cc;
+	r.intersect = intersect;
+	r.done = false;
+	if(pool!=NULL){
+		submit_pool(r);
+		return;
+	}
+	bool waited = false;
+	pthread_mutex_lock(&batch_lock);
+	pending.push_back(&r);
+	pending_pairs += cc.pair_num;
+	pthread_cond_broadcast(&batch_cond);
+	while(!r.done){
+		if(dispatching){
+			pthread_cond_wait(&batch_cond, &batch_lock);
+			continue;
+		}
+		if(!waited&&batch_wait>0&&pending_pairs<batch_pairs){
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += (long)batch_wait*1000;
+			ts.tv_sec += ts.tv_nsec/1000000000;
+			ts.tv_nsec %= 1000000000;
+			// woken up by the new requests or the finished batches
+			while(!r.done&&!dispatching&&pending_pairs<batch_pairs){
+				if(pthread_cond_timedwait(&batch_cond, &batch_lock, &ts)!=0){
+					break;
+				}
+			}
+			waited = true;
+			continue;
+		}
+		// lead this batch
+		vector<batch_request *> requests = take_pending();
+		dispatching = true;
+		pthread_mutex_unlock(&batch_lock);
+
+		dispatch(requests);
+
+		pthread_mutex_lock(&batch_lock);
+		for(batch_request *req:requests){
+			req->done = true;
+		}
+		dispatching = false;
+		pthread_cond_broadcast(&batch_cond);
+	}
+	pthread_mutex_unlock(&batch_lock);
+}
+
+/*
+ * the requesters in the pool never sleep on the batch, such that
+ * the kernels of the batches are run by all the workers. The first
+ * request collects the next batch and runs the tasks in the pool
+ * meanwhile, the others wait for their groups held until computed,
+ * running the tasks as well. The batches are dispatched in parallel
+ * */
+void geometry_computer::submit_pool(batch_request &r){
+	pool->hold(r.group);
+	pthread_mutex_lock(&batch_lock);
+	pending.push_back(&r);
+	pending_pairs += r.param->pair_num;
+	const bool lead = !collecting;
+	collecting = true;
+	pthread_mutex_unlock(&batch_lock);
+	if(!lead){
+		pool->wait(r.group);
+		return;
+	}
+	struct timeval start = get_cur_time();
+	pthread_mutex_lock(&batch_lock);
+	while(pending_pairs<batch_pairs&&get_time_elapsed(start)*1000<batch_wait){
+		pthread_mutex_unlock(&batch_lock);
+		if(!pool->help()){
+			sched_yield();
+		}
+		pthread_mutex_lock(&batch_lock);
+	}
+	vector<batch_request *> requests = take_pending();
+	collecting = false;
+	pthread_mutex_unlock(&batch_lock);
+
+	dispatch(requests);
+	for(batch_request *req:requests){
+		pool->release(req->group);
+	}
+	// the own request is in this batch
+	assert(r.group.done());
+}
+
+void geometry_computer::report(){
+	if(dispatches>0){
+		log("geometry computer: %ld dispatches, %ld requests batched", dispatches, batched);
+	}
+}
+
+}
@@ -13,6 +13,7 @@
 #include <cstring>
 #include <cmath>
 #include <map>
+#include <set>
 #include <vector>
 #include <cstdlib>
 #include <algorithm>
@@ -35,6 +36,8 @@ namespace hispeed{
  * */
 class OctreeNode {
 	weighted_aab node_voxel;
+	void query_knn(weighted_aab *box, vector<pair<int, range>> &results, uint k,
+			vector<float> &heap, set<int> &visited);
 public:
 	long tile_size;
 	int level;
@@ -52,6 +55,8 @@ public:
 	void genTiles(vector<aab> &tiles);
 	void query_distance(weighted_aab *box, vector<pair<int, range>> &results, float min_farthest=DBL_MAX);
 	void query_intersect(weighted_aab *box, vector<int> &results);
+	// the objects which can be among the k nearest neighbors of box
+	void query_knn(weighted_aab *box, vector<pair<int, range>> &results, uint k);
 
 };
 OctreeNode *build_octree(std::vector<weighted_aab*> &mbbs, int num_tiles);
@@ -175,6 +175,66 @@ void OctreeNode::query_intersect(weighted_aab *box, vector<int> &results){
 	}
 }
 
+// the k-th smallest farthest distance found so far
+inline float knn_threshold(vector<float> &heap, uint k){
+	return heap.size()<k?FLT_MAX:heap.front();
+}
+
+void OctreeNode::query_knn(weighted_aab *box, vector<pair<int, range>> &results, uint k,
+		vector<float> &heap, set<int> &visited){
+	if(node_voxel.distance(*box).closest>knn_threshold(heap, k)){
+		return;
+	}
+	if(isLeaf){
+		for(weighted_aab *obj:objectList){
+			// avoid self comparing, and the objects in multiple leaves
+			if(obj==box||!visited.insert(obj->id).second){
+				continue;
+			}
+			range dis = obj->distance(*box);
+			if(dis.closest>knn_threshold(heap, k)){
+				continue;
+			}
+			results.push_back(pair<int, range>(obj->id, dis));
+			// keep the k smallest farthest distances in a max heap
+			if(heap.size()<k){
+				heap.push_back(dis.farthest);
+				std::push_heap(heap.begin(), heap.end());
+			}else if(dis.farthest<heap.front()){
+				std::pop_heap(heap.begin(), heap.end());
+				heap.back() = dis.farthest;
+				std::push_heap(heap.begin(), heap.end());
+			}
+		}
+	}else{
+		// visit the nearer children first to tighten the threshold early
+		vector<pair<float, OctreeNode *>> order;
+		for(OctreeNode *c:children){
+			order.push_back(pair<float, OctreeNode *>(c->node_voxel.distance(*box).closest, c));
+		}
+		std::sort(order.begin(), order.end());
+		for(pair<float, OctreeNode *> &c:order){
+			c.second->query_knn(box, results, k, heap, visited);
+		}
+	}
+}
+
+void OctreeNode::query_knn(weighted_aab *box, vector<pair<int, range>> &results, uint k){
+	assert(k>0);
+	vector<float> heap;
+	set<int> visited;
+	query_knn(box, results, k, heap, visited);
+	// drop the ones found before the threshold is tightened
+	const float threshold = knn_threshold(heap, k);
+	size_t kept = 0;
+	for(pair<int, range> &r:results){
+		if(r.second.closest<=threshold){
+			results[kept++] = r;
+		}
+	}
+	results.resize(kept);
+}
+
 OctreeNode *build_octree(std::vector<weighted_aab*> &voxels, int leaf_size){
 	// the main thread build the OCTree with the Minimum Boundary Box
 	// get from the data
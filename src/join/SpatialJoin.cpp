@@ -8,95 +8,479 @@
 #include <math.h>
 #include <map>
 #include <tuple>
+#include <list>
 #include "SpatialJoin.h"
+#include "../geometry/bvh.h"
 
 using namespace std;
 
 namespace hispeed{
 
 
-inline bool update_voxel_pair_list(vector<voxel_pair> &voxel_pairs, range &d){
-	int voxel_pair_size = voxel_pairs.size();
-	for(int j=0;j<voxel_pair_size;){
-		if(d>voxel_pairs[j].dist){
-			return false;
-		}else if(d<voxel_pairs[j].dist){
-			// evict this voxel pairs
-			voxel_pairs.erase(voxel_pairs.begin()+j);
-			voxel_pair_size--;
+// prefetch the objects referred by the candidate list
+inline void prefetch_candidates(Tile *tile1, Tile *tile2, candidate_set &candidates){
+	vector<int> ids1;
+	vector<int> ids2;
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(!candidates.object_alive(o)){
+			continue;
+		}
+		ids1.push_back(candidates.object(o)->id);
+		for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+			if(candidates.candidate_alive(c)){
+				ids2.push_back(candidates.target(c)->id);
+			}
+		}
+	}
+	if(tile1==tile2){
+		ids1.insert(ids1.end(), ids2.begin(), ids2.end());
+		tile1->prefetch(ids1);
+	}else{
+		tile1->prefetch(ids1);
+		tile2->prefetch(ids2);
+	}
+}
+
+// get the ids of the objects referred by the voxel pairs in the
+// candidate list to be evaluated at lod, sorted and deduplicated
+inline void collect_candidates(candidate_set &candidates, int lod, vector<int> &ids1, vector<int> &ids2){
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(!candidates.object_alive(o)){
+			continue;
+		}
+		bool referred = false;
+		for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+			if(candidates.candidate_alive(c)&&candidates.num_pairs(c)>0&&
+			   candidates.level(c)<=lod){
+				ids2.push_back(candidates.target(c)->id);
+				referred = true;
+			}
+		}
+		if(referred){
+			ids1.push_back(candidates.object(o)->id);
+		}
+	}
+	std::sort(ids1.begin(), ids1.end());
+	ids1.erase(std::unique(ids1.begin(), ids1.end()), ids1.end());
+	std::sort(ids2.begin(), ids2.end());
+	ids2.erase(std::unique(ids2.begin(), ids2.end()), ids2.end());
+}
+
+// the objects to be filled by multiple threads or tasks,
+// each of which takes the next one in turn
+class fill_param{
+public:
+	Tile *tile1 = NULL;
+	Tile *tile2 = NULL;
+	vector<int> *ids1 = NULL;
+	vector<int> *ids2 = NULL;
+	int lod = -1;
+	enum data_type seg_tri = DT_Segment;
+	bool release_mesh = false;
+	// next object to be filled, ids2 follow ids1
+	size_t next = 0;
+	pthread_mutex_t lock;
+	fill_param(){
+		pthread_mutex_init(&lock, NULL);
+	}
+};
+
+void *fill_unit(void *arg){
+	fill_param *fp = (fill_param *)arg;
+	while(true){
+		pthread_mutex_lock(&fp->lock);
+		size_t i = fp->next++;
+		pthread_mutex_unlock(&fp->lock);
+		if(i<fp->ids1->size()){
+			fp->tile1->fill_to((*fp->ids1)[i], fp->lod, fp->seg_tri, fp->release_mesh);
+		}else if(i<fp->ids1->size()+fp->ids2->size()){
+			fp->tile2->fill_to((*fp->ids2)[i-fp->ids1->size()], fp->lod, fp->seg_tri, fp->release_mesh);
 		}else{
-			j++;
+			break;
 		}
 	}
-	return true;
+	return NULL;
+}
+
+// decode the objects referred by the candidate list to lod and fill
+// their voxels, the ids of the filled objects are returned in
+// ids1 and ids2 for unpinning them after this round
+inline void fill_candidates(Tile *tile1, Tile *tile2, candidate_set &candidates,
+		int lod, enum data_type seg_tri, bool release_mesh,
+		vector<int> &ids1, vector<int> &ids2, task_pool *pool){
+	collect_candidates(candidates, lod, ids1, ids2);
+	if(pool==NULL){
+		for(int id:ids1){
+			tile1->fill_to(id, lod, seg_tri, release_mesh);
+		}
+		for(int id:ids2){
+			tile2->fill_to(id, lod, seg_tri, release_mesh);
+		}
+		return;
+	}
+	fill_param fp;
+	fp.tile1 = tile1;
+	fp.tile2 = tile2;
+	fp.ids1 = &ids1;
+	fp.ids2 = &ids2;
+	fp.lod = lod;
+	fp.seg_tri = seg_tri;
+	fp.release_mesh = release_mesh;
+	task_group group;
+	int num_units = std::min((size_t)pool->num_threads(), ids1.size()+ids2.size());
+	for(int i=0;i<num_units;i++){
+		pool->submit(group, fill_unit, (void *)&fp);
+	}
+	pool->wait(group);
+}
+
+inline void unpin_candidates(Tile *tile1, Tile *tile2, int lod,
+		vector<int> &ids1, vector<int> &ids2){
+	for(int id:ids1){
+		tile1->unpin(id, lod);
+	}
+	for(int id:ids2){
+		tile2->unpin(id, lod);
+	}
+	ids1.clear();
+	ids2.clear();
+}
+
+// unpin the objects filled for this round, and drop the voxels of
+// the ones no live candidate refers to any more, the number of
+// the dropped objects is returned
+inline size_t release_candidates(Tile *tile1, Tile *tile2, candidate_set &candidates,
+		int lod, vector<int> &ids1, vector<int> &ids2){
+	vector<int> live1;
+	vector<int> live2;
+	collect_candidates(candidates, INT_MAX, live1, live2);
+	if(tile1==tile2){
+		// the objects of a self join can be used by either side
+		live1.insert(live1.end(), live2.begin(), live2.end());
+		std::sort(live1.begin(), live1.end());
+		live2 = live1;
+	}
+	size_t dropped = 0;
+	for(int id:ids1){
+		if(std::binary_search(live1.begin(), live1.end(), id)){
+			tile1->unpin(id, lod);
+		}else if(tile1->drop(id, lod)){
+			dropped++;
+		}
+	}
+	for(int id:ids2){
+		if(std::binary_search(live2.begin(), live2.end(), id)){
+			tile2->unpin(id, lod);
+		}else if(tile2->drop(id, lod)){
+			dropped++;
+		}
+	}
+	ids1.clear();
+	ids2.clear();
+	return dropped;
+}
+
+/*
+ * decode the next LOD for the current candidates in the
+ * background while the distances or intersections of this
+ * LOD are being computed. The objects pruned in this round
+ * are discarded when the next round starts.
+ * */
+class lod_speculator{
+	vector<int> ids1;
+	vector<int> ids2;
+	fill_param fp;
+	vector<pthread_t> threads;
+	// fill with the tasks in the pool if set
+	task_pool *pool;
+	task_group group;
+	void settle(Tile *tile, vector<int> &filled, vector<int> &used, vector<int> &also_used);
+public:
+	size_t speculated = 0;
+	size_t discarded = 0;
+	lod_speculator(Tile *t1, Tile *t2, task_pool *p){
+		fp.tile1 = t1;
+		fp.tile2 = t2;
+		fp.ids1 = &ids1;
+		fp.ids2 = &ids2;
+		pool = p;
+	}
+	~lod_speculator(){
+		assert(threads.empty()&&group.done()&&ids1.empty()&&ids2.empty());
+	}
+	void start(candidate_set &candidates, int l, enum data_type st, bool rm, int num_threads);
+	// wait for the background filling
+	void join();
+	// take over the objects used by the next round in ids1
+	// and ids2, and discard the others
+	void settle(vector<int> &used1, vector<int> &used2);
+};
+
+void lod_speculator::start(candidate_set &candidates, int l, enum data_type st, bool rm, int num_threads){
+	assert(threads.empty()&&group.done()&&num_threads>0);
+	fp.lod = l;
+	fp.seg_tri = st;
+	fp.release_mesh = rm;
+	fp.next = 0;
+	collect_candidates(candidates, l, ids1, ids2);
+	speculated += ids1.size()+ids2.size();
+	if(pool!=NULL){
+		for(int i=0;i<num_threads;i++){
+			pool->submit(group, fill_unit, (void *)&fp);
+		}
+		return;
+	}
+	threads.resize(num_threads);
+	for(int i=0;i<num_threads;i++){
+		pthread_create(&threads[i], NULL, fill_unit, (void *)&fp);
+	}
+}
+
+void lod_speculator::join(){
+	if(pool!=NULL){
+		pool->wait(group);
+	}
+	for(pthread_t &t:threads){
+		void *status;
+		pthread_join(t, &status);
+	}
+	threads.clear();
 }
 
-inline bool update_candidate_list(vector<candidate_info> &candidate_list, range &d){
-	int list_size = candidate_list.size();
-	for(int i=0;i<list_size;){
-		if(d>candidate_list[i].distance){
-			// should not keep since there is a closer one
-			// in the candidate list
-			return false;
-		}else if(d<candidate_list[i].distance){
-			// one candidate in the list cannot be the closest
-			// remove it, together with the voxels, from the candidate list
-			candidate_list[i].voxel_pairs.clear();
-			candidate_list.erase(candidate_list.begin()+i);
-			list_size--;
+void lod_speculator::settle(Tile *tile, vector<int> &filled, vector<int> &used, vector<int> &also_used){
+	for(int id:filled){
+		if(std::binary_search(used.begin(), used.end(), id)||
+		   std::binary_search(also_used.begin(), also_used.end(), id)){
+			// pinned again by the next round
+			tile->unpin(id, fp.lod);
 		}else{
-			// go deep into checking the voxel pairs
-			if(!update_voxel_pair_list(candidate_list[i].voxel_pairs, d)){
-				return false;
-			}
-			// current candidate can be removed after comparing the voxel pairs
-			// if all voxel pairs are farther compared to current one
-			if(candidate_list[i].voxel_pairs.size()==0){
-				candidate_list.erase(candidate_list.begin()+i);
-				list_size--;
-			}else{
-				i++;
-			}
-		}//end if
-	}//end for
-	// the target one should be kept
-	return true;
+			tile->drop(id, fp.lod);
+			discarded++;
+		}
+	}
+	filled.clear();
 }
 
-inline size_t get_pair_num(vector<candidate_entry> &candidates){
-	size_t pair_num = 0;
-	for(candidate_entry p:candidates){
-		for(candidate_info c:p.second){
-			pair_num += c.voxel_pairs.size();
+void lod_speculator::settle(vector<int> &used1, vector<int> &used2){
+	join();
+	vector<int> none;
+	Tile *tile1 = fp.tile1;
+	Tile *tile2 = fp.tile2;
+	// the objects of a self join can be used by either side
+	settle(tile1, ids1, used1, tile1==tile2?used2:none);
+	settle(tile2, ids2, used2, tile1==tile2?used1:none);
+}
+
+voxel_packer::voxel_packer(Tile *tile1, Tile *tile2){
+	base2 = tile1==tile2?0:tile1->num_voxels();
+	slots.resize(base2+tile2->num_voxels(), UINT_MAX);
+}
+
+voxel_packer::~voxel_packer(){
+	if(data!=NULL){
+		delete []data;
+	}
+}
+
+void voxel_packer::reset(int l, enum data_type seg_tri){
+	for(size_t index:indices){
+		slots[index] = UINT_MAX;
+	}
+	indices.clear();
+	voxels.clear();
+	sizes.clear();
+	offsets.clear();
+	data_num = 0;
+	lod = l;
+	datum_size = seg_tri==DT_Segment?6:9;
+}
+
+uint voxel_packer::add(Voxel *v, bool second){
+	assert(v->id>=0);
+	size_t index = v->id+(second?base2:0);
+	assert(index<slots.size());
+	if(slots[index]==UINT_MAX){
+		slots[index] = voxels.size();
+		voxels.push_back(v);
+		indices.push_back(index);
+		map<int, int>::iterator it = v->size.find(lod);
+		sizes.push_back(it==v->size.end()?0:it->second);
+	}
+	return slots[index];
+}
+
+size_t voxel_packer::prefix(){
+	offsets.resize(voxels.size());
+	size_t total = 0;
+	for(size_t i=0;i<voxels.size();i++){
+		offsets[i] = total;
+		total += sizes[i];
+	}
+	data_num = total;
+	return total;
+}
+
+typedef struct pack_param_{
+	float *data;
+	int datum_size;
+	int lod;
+	Voxel **voxels;
+	uint *sizes;
+	uint *offsets;
+	size_t num;
+}pack_param;
+
+void *pack_unit(void *arg){
+	pack_param *param = (pack_param *)arg;
+	for(size_t i=0;i<param->num;i++){
+		if(param->sizes[i]>0){
+			memcpy(param->data+(size_t)param->offsets[i]*param->datum_size,
+				   param->voxels[i]->data[param->lod],
+				   (size_t)param->sizes[i]*param->datum_size*sizeof(float));
 		}
 	}
-	return pair_num;
+	return NULL;
 }
 
-inline size_t get_candidate_num(vector<candidate_entry> &candidates){
-	size_t candidate_num = 0;
-	for(candidate_entry p:candidates){
-		candidate_num += p.second.size();
+float *voxel_packer::pack(int num_threads, task_pool *pool){
+	if(data_num*datum_size>capacity){
+		if(data!=NULL){
+			delete []data;
+		}
+		capacity = data_num*datum_size;
+		data = new float[capacity];
+	}
+	// not worth parallelizing small copies
+	const size_t min_floats = 1<<18;
+	if(pool!=NULL){
+		num_threads = pool->num_threads();
+	}
+	num_threads = std::max(1, std::min(num_threads, (int)(data_num*datum_size/min_floats)));
+	num_threads = std::min(num_threads, (int)std::max((size_t)1, voxels.size()));
+	pack_param params[num_threads];
+	pthread_t threads[num_threads];
+	// split the voxels with similar amount of data for each thread
+	size_t begin = 0;
+	for(int i=0;i<num_threads;i++){
+		size_t target = data_num*(i+1)/num_threads;
+		size_t end = begin;
+		while(end<voxels.size()&&(i==num_threads-1||offsets[end]<target)){
+			end++;
+		}
+		params[i].data = data;
+		params[i].datum_size = datum_size;
+		params[i].lod = lod;
+		params[i].voxels = voxels.data()+begin;
+		params[i].sizes = sizes.data()+begin;
+		params[i].offsets = offsets.data()+begin;
+		params[i].num = end-begin;
+		begin = end;
+	}
+	if(pool!=NULL){
+		task_group group;
+		for(int i=0;i<num_threads;i++){
+			pool->submit(group, pack_unit, (void *)&params[i]);
+		}
+		pool->wait(group);
+		return data;
+	}
+	for(int i=1;i<num_threads;i++){
+		pthread_create(&threads[i], NULL, pack_unit, (void *)&params[i]);
 	}
-	return candidate_num;
+	pack_unit((void *)&params[0]);
+	for(int i=1;i<num_threads;i++){
+		void *status;
+		pthread_join(threads[i], &status);
+	}
+	return data;
 }
 
 bool compare_pair(pair<int, range> a1, pair<int, range> a2){
 	return a1.first<a2.first;
 }
 
-void report_candidate(vector<candidate_entry> &candidates){
-	for(vector<candidate_entry>::iterator it=candidates.begin();it!=candidates.end();){
-		if(it->second.size()<2){
-			it = candidates.erase(it);
-		}else{
-			it++;
+inline void emit_result(result_sink *sink, Tile *tile1, Tile *tile2,
+		HiMesh_Wrapper *wrapper1, HiMesh_Wrapper *wrapper2, range &dist){
+	if(sink==NULL){
+		return;
+	}
+	join_result r;
+	r.tile1 = tile1->get_tag();
+	r.id1 = wrapper1->origin;
+	r.tile2 = tile2->get_tag();
+	r.id2 = wrapper2->origin;
+	// the distances are kept squared in the joins
+	r.closest = sqrt(std::max(dist.closest, (float)0));
+	r.farthest = sqrt(std::max(dist.farthest, (float)0));
+	sink->emit(r);
+}
+
+// emit candidate c of object o with the nearest of its voxel pairs
+inline void emit_candidate(result_sink *sink, Tile *tile1, Tile *tile2,
+		candidate_set &candidates, uint o, uint c){
+	if(sink==NULL){
+		return;
+	}
+	range dist = candidates.distance(c);
+	if(candidates.num_pairs(c)>0){
+		dist.closest = FLT_MAX;
+		dist.farthest = FLT_MAX;
+		for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+			if(candidates.pair_alive(p)){
+				dist.closest = std::min(dist.closest, candidates.pair(p).dist.closest);
+				dist.farthest = std::min(dist.farthest, candidates.pair(p).dist.farthest);
+			}
 		}
 	}
+	emit_result(sink, tile1, tile2, candidates.object(o), candidates.target(c), dist);
+}
 
+// emit the k nearest candidates left for object o as its nearest
+// neighbors, the ties are broken by the IDs of the targets. Then
+// remove it together with its voxel pairs
+inline void report_object(candidate_set &candidates, uint o, uint k,
+		result_sink *sink, Tile *tile1, Tile *tile2){
+	vector<std::pair<std::pair<float, int>, uint>> order;
+	for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+		if(candidates.candidate_alive(c)){
+			float farthest = candidates.distance(c).farthest;
+			if(candidates.num_pairs(c)>0){
+				farthest = FLT_MAX;
+			}
+			for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+				if(candidates.pair_alive(p)){
+					farthest = std::min(farthest, candidates.pair(p).dist.farthest);
+				}
+			}
+			order.push_back(std::make_pair(std::make_pair(farthest, candidates.target(c)->id), c));
+		}
+	}
+	if(order.size()>k){
+		std::partial_sort(order.begin(), order.begin()+k, order.end());
+		order.resize(k);
+	}
+	for(auto &e:order){
+		emit_candidate(sink, tile1, tile2, candidates, o, e.second);
+	}
+	candidates.remove_object(o);
+}
+
+// the k nearest neighbors are found for the objects with k candidates
+// left, or for all the objects left if all is set
+void report_candidate(candidate_set &candidates, uint k,
+		result_sink *sink, Tile *tile1, Tile *tile2, bool all = false){
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(candidates.object_alive(o)&&(all||candidates.num_candidates(o)<=k)){
+			report_object(candidates, o, k, sink, tile1, tile2);
+		}
+	}
 }
 
 void SpatialJoin::report_time(double t){
+	// nothing is joined
+	if(global_total_time==0){
+		return;
+	}
 	cout<<"total, index, decode, packing, computation, updatelist, other"<<endl;
 	cout<<t<<","
 		<<t*global_index_time/global_total_time<<","
@@ -105,6 +489,12 @@ void SpatialJoin::report_time(double t){
 		<<t*global_computation_time/global_total_time<<","
 		<<t*global_updatelist_time/global_total_time<<","
 		<<t*(global_total_time-global_decode_time-global_computation_time-global_index_time)/global_total_time<<endl;
+	if(global_results>0){
+		cout<<"results: "<<global_results<<endl;
+	}
+	if(global_released>0){
+		cout<<"released early: "<<global_released<<endl;
+	}
 //	cout<<"total, decode, computation, other"<<endl;
 //	t /= 1000;
 //	cout<<t<<","
@@ -113,18 +503,214 @@ void SpatialJoin::report_time(double t){
 //		<<t*(global_total_time-global_decode_time-global_computation_time)/global_total_time<<endl;
 }
 
-vector<candidate_entry> SpatialJoin::mbb_distance(Tile *tile1, Tile *tile2){
-	vector<candidate_entry> candidates;
-	vector<pair<int, range>> candidate_ids;
+void SpatialJoin::init_lods(){
+	pthread_mutex_lock(&g_lock);
+	if(lods.size()==0){
+		for(int lod = base_lod;lod<=top_lod;lod+=lod_gap){
+			lods.push_back(lod);
+		}
+		if(lods[lods.size()-1]<top_lod){
+			lods.push_back(top_lod);
+		}
+	}
+	pthread_mutex_unlock(&g_lock);
+}
+
+void SpatialJoin::add_time(join_timer &timer, struct timeval &very_start){
+	pthread_mutex_lock(&g_lock);
+	global_index_time += timer.index_time;
+	global_decode_time += timer.decode_time;
+	global_packing_time += timer.packing_time;
+	global_computation_time += timer.computation_time;
+	global_updatelist_time += timer.updatelist_time;
+	global_results += timer.results;
+	global_released += timer.released;
+	global_total_time += hispeed::get_time_elapsed(very_start, false);
+	pthread_mutex_unlock(&g_lock);
+}
+
+/*
+ * the candidates are evaluated in windows of tile1 objects
+ * ordered along the Hilbert curve. Only the objects referred
+ * by the current window are decoded, and they are released
+ * once no later window refers to them. The next window is
+ * prefetched while the current one is evaluated.
+ * */
+void SpatialJoin::stream(Tile *tile1, Tile *tile2, candidate_set &candidates,
+		Join_Type type, join_timer &timer, vector<char> *intersected){
+	assert(window_size>0);
+	struct timeval start = get_cur_time();
+	// order the candidates by the positions of the tile1 objects
+	const int bits = 16;
+	aab space = tile1->get_box();
+	float scale[3];
+	for(int i=0;i<3;i++){
+		float extent = space.max[i]-space.min[i];
+		scale[i] = extent>0?((1<<bits)-1)/extent:0;
+	}
+	vector<pair<uint64_t, uint>> order;
+	order.reserve(candidates.object_num());
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(!candidates.object_alive(o)){
+			continue;
+		}
+		aab &b = candidates.object(o)->box.box;
+		uint32_t c[3];
+		for(int k=0;k<3;k++){
+			c[k] = (uint32_t)(((b.min[k]+b.max[k])/2-space.min[k])*scale[k]);
+		}
+		order.push_back(pair<uint64_t, uint>(hilbert_key(c[0], c[1], c[2], bits), o));
+	}
+	std::sort(order.begin(), order.end());
+
+	// split into windows, and find the last window referring to each object
+	const size_t num_windows = (order.size()+window_size-1)/window_size;
+	vector<candidate_set> windows(num_windows);
+	vector<size_t> last1(tile1->num_objects(), 0);
+	vector<size_t> last2(tile2->num_objects(), 0);
+	vector<size_t> &last_ref = tile1==tile2?last1:last2;
+	for(size_t i=0;i<order.size();i++){
+		size_t w = i/window_size;
+		uint o = order[i].second;
+		last1[candidates.object(o)->id] = w;
+		for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+			if(candidates.candidate_alive(c)){
+				last_ref[candidates.target(c)->id] = w;
+			}
+		}
+		windows[w].append(candidates, o);
+	}
+	candidates = candidate_set();
+	timer.index_time += hispeed::get_time_elapsed(start, false);
+	logt("split %ld candidates into %ld windows", start, order.size(), num_windows);
+
+	if(num_windows>0){
+		prefetch_candidates(tile1, tile2, windows[0]);
+	}
+	voxel_packer packer(tile1, tile2);
+	for(size_t w=0;w<num_windows;w++){
+		candidate_set &window = windows[w];
+		// the objects not referred by the later windows
+		vector<int> ids1;
+		vector<int> ids2;
+		for(uint o=0;o<window.num_rows();o++){
+			if(last1[window.object(o)->id]==w){
+				ids1.push_back(window.object(o)->id);
+			}
+			for(uint c=window.cand_begin(o);c<window.cand_end(o);c++){
+				if(last_ref[window.target(c)->id]==w){
+					(tile1==tile2?ids1:ids2).push_back(window.target(c)->id);
+				}
+			}
+		}
+		if(w+1<num_windows){
+			prefetch_candidates(tile1, tile2, windows[w+1]);
+		}
+		if(type==JT_intersect){
+			intersect_lods(tile1, tile2, window, packer, timer, intersected);
+		}else{
+			distance_lods(tile1, tile2, window, packer, timer, type);
+		}
+		window = candidate_set();
+		start = get_cur_time();
+		std::sort(ids1.begin(), ids1.end());
+		ids1.erase(std::unique(ids1.begin(), ids1.end()), ids1.end());
+		std::sort(ids2.begin(), ids2.end());
+		ids2.erase(std::unique(ids2.begin(), ids2.end()), ids2.end());
+		for(int id:ids1){
+			tile1->release(id);
+		}
+		for(int id:ids2){
+			tile2->release(id);
+		}
+		timer.decode_time += hispeed::get_time_elapsed(start, false);
+		log("window %ld/%ld released %ld objects", w+1, num_windows, ids1.size()+ids2.size());
+	}
+}
+
+// the tile1 objects in [begin, end) probed by one thread or task
+class filter_param{
+public:
+	Tile *tile1 = NULL;
+	Tile *tile2 = NULL;
+	OctreeNode *tree = NULL;
+	int begin = 0;
+	int end = 0;
+	// for the within distance join
+	float distance = 0;
+	size_t accepted = 0;
+	result_sink *sink = NULL;
+	// for the k nearest neighbor join
+	uint k = 1;
+	// for the symmetric self join, only the pairs of
+	// objects in ascending order are kept
+	bool symmetric = false;
+	candidate_set candidates;
+};
+
+// probe the tile1 objects in ranges with multiple threads or tasks.
+// The candidates found for each range are merged in order, such that
+// the result does not depend on the number of threads. The number
+// of pairs accepted without further evaluation is returned
+inline size_t probe_objects(Tile *tile1, Tile *tile2, candidate_set &candidates,
+		task_func unit, task_pool *pool, float distance = 0, uint k = 1,
+		result_sink *sink = NULL, bool symmetric = false){
 	OctreeNode *tree = tile2->build_octree(400);
-	for(int i=0;i<tile1->num_objects();i++){
-		vector<candidate_info> candidate_list;
-		HiMesh_Wrapper *wrapper1 = tile1->get_mesh_wrapper(i);
-		tree->query_distance(&(wrapper1->box), candidate_ids);
+	int num_units = pool!=NULL?4*pool->num_threads():hispeed::get_num_threads();
+	// not worth parallelizing small tiles
+	const int min_objects = 64;
+	num_units = std::max(1, std::min(num_units, tile1->num_objects()/min_objects));
+	vector<filter_param> params(num_units);
+	for(int i=0;i<num_units;i++){
+		params[i].tile1 = tile1;
+		params[i].tile2 = tile2;
+		params[i].tree = tree;
+		params[i].begin = (long)tile1->num_objects()*i/num_units;
+		params[i].end = (long)tile1->num_objects()*(i+1)/num_units;
+		params[i].distance = distance;
+		params[i].k = k;
+		params[i].sink = sink;
+		params[i].symmetric = symmetric;
+	}
+	if(pool!=NULL){
+		task_group group;
+		for(filter_param &fp:params){
+			pool->submit(group, unit, (void *)&fp);
+		}
+		pool->wait(group);
+	}else{
+		pthread_t threads[num_units];
+		for(int i=1;i<num_units;i++){
+			pthread_create(&threads[i], NULL, unit, (void *)&params[i]);
+		}
+		unit((void *)&params[0]);
+		for(int i=1;i<num_units;i++){
+			void *status;
+			pthread_join(threads[i], &status);
+		}
+	}
+	size_t accepted = 0;
+	for(filter_param &fp:params){
+		candidates.append(fp.candidates);
+		accepted += fp.accepted;
+	}
+	delete tree;
+	return accepted;
+}
+
+void *mbb_distance_unit(void *arg){
+	filter_param *fp = (filter_param *)arg;
+	candidate_set &candidates = fp->candidates;
+	Tile *tile2 = fp->tile2;
+	vector<pair<int, range>> candidate_ids;
+	for(int i=fp->begin;i<fp->end;i++){
+		HiMesh_Wrapper *wrapper1 = fp->tile1->get_mesh_wrapper(i);
+		fp->tree->query_distance(&(wrapper1->box), candidate_ids);
 		if(candidate_ids.empty()){
 			continue;
 		}
 		std::sort(candidate_ids.begin(), candidate_ids.end(), compare_pair);
+		uint o = candidates.begin_object(wrapper1);
 		int former = -1;
 		for(pair<int, range> &p:candidate_ids){
 			if(p.first==former){
@@ -137,33 +723,70 @@ vector<candidate_entry> SpatialJoin::mbb_distance(Tile *tile1, Tile *tile2){
 			// a suitable candidate, and then we further go
 			// through the voxels in two objects to shrink
 			// the candidate list in a fine grained
-			if(update_candidate_list(candidate_list, p.second)){
-				candidate_info ci;
+			if(candidates.update_candidates(o, p.second)){
+				uint c = candidates.add_candidate(wrapper2, p.second);
 				for(Voxel *v1:wrapper1->voxels){
 					for(Voxel *v2:wrapper2->voxels){
 						range tmpd = v1->box.distance(v2->box);
 						// no voxel pair in the lists is nearer
-						if(update_voxel_pair_list(ci.voxel_pairs, tmpd) &&
-						   update_candidate_list(candidate_list, tmpd)){
-							ci.voxel_pairs.push_back(voxel_pair(v1, v2, tmpd));
-							ci.distance.update(tmpd);
+						if(candidates.update_pairs(c, tmpd) &&
+						   candidates.update_candidates(o, tmpd, c)){
+							candidates.add_pair(voxel_pair(v1, v2, tmpd));
 						}
 					}
 				}
-				// some voxel pairs need be further evaluated
-				if(ci.voxel_pairs.size()>0){
-					ci.distance = p.second;
-					ci.mesh_wrapper = wrapper2;
-					candidate_list.push_back(ci);
+				// no voxel pair need be further evaluated
+				if(candidates.num_pairs(c)==0){
+					candidates.remove_candidate(o, c);
 				}
 			}
 			former = p.first;
 		}
-		// save the candidate list
-		candidates.push_back(candidate_entry(wrapper1, candidate_list));
+		// drop the pruned ones in the candidate list
+		candidates.end_object();
+		candidate_ids.clear();
+	}
+	return NULL;
+}
+
+// the candidates for the k nearest neighbors are kept in a bounded heap
+// while probing the octree, and pruned with the k-th nearest one
+void *mbb_knn_unit(void *arg){
+	filter_param *fp = (filter_param *)arg;
+	candidate_set &candidates = fp->candidates;
+	Tile *tile2 = fp->tile2;
+	vector<pair<int, range>> candidate_ids;
+	for(int i=fp->begin;i<fp->end;i++){
+		HiMesh_Wrapper *wrapper1 = fp->tile1->get_mesh_wrapper(i);
+		fp->tree->query_knn(&(wrapper1->box), candidate_ids, fp->k);
+		if(candidate_ids.empty()){
+			continue;
+		}
+		std::sort(candidate_ids.begin(), candidate_ids.end(), compare_pair);
+		uint o = candidates.begin_object(wrapper1);
+		for(pair<int, range> &p:candidate_ids){
+			HiMesh_Wrapper *wrapper2 = tile2->get_mesh_wrapper(p.first);
+			uint c = candidates.add_candidate(wrapper2, p.second);
+			for(Voxel *v1:wrapper1->voxels){
+				for(Voxel *v2:wrapper2->voxels){
+					candidates.add_pair(voxel_pair(v1, v2, v1->box.distance(v2->box)));
+				}
+			}
+		}
+		candidates.update_candidates_knn(o, fp->k);
+		// drop the pruned ones in the candidate list
+		candidates.end_object();
 		candidate_ids.clear();
 	}
-	return candidates;
+	return NULL;
+}
+
+void SpatialJoin::mbb_distance(Tile *tile1, Tile *tile2, candidate_set &candidates){
+	if(knn_k>1){
+		probe_objects(tile1, tile2, candidates, mbb_knn_unit, pool, 0, knn_k);
+	}else{
+		probe_objects(tile1, tile2, candidates, mbb_distance_unit, pool);
+	}
 }
 
 
@@ -174,94 +797,357 @@ vector<candidate_entry> SpatialJoin::mbb_distance(Tile *tile1, Tile *tile2){
 void SpatialJoin::nearest_neighbor(Tile *tile1, Tile *tile2){
 	struct timeval start = get_cur_time();
 	struct timeval very_start = get_cur_time();
-
-	double index_time = 0;
-	double decode_time = 0;
-	double packing_time = 0;
-	double computation_time = 0;
-	double updatelist_time = 0;
+	join_timer timer;
 	// filtering with MBBs to get the candidate list
-	vector<candidate_entry> candidates = mbb_distance(tile1, tile2);
-	index_time += get_time_elapsed(start, false);
+	candidate_set candidates;
+	mbb_distance(tile1, tile2, candidates);
+	timer.index_time += get_time_elapsed(start, false);
 	logt("comparing mbbs", start);
-	report_candidate(candidates);
+	report_candidate(candidates, knn_k, sink, tile1, tile2);
+	if(window_size>0){
+		stream(tile1, tile2, candidates, JT_nearest, timer);
+	}else{
+		prefetch_candidates(tile1, tile2, candidates);
+		voxel_packer packer(tile1, tile2);
+		distance_lods(tile1, tile2, candidates, packer, timer, JT_nearest);
+	}
+	add_time(timer, very_start);
+}
 
+/*
+ * pick the LOD a candidate is evaluated next with its remaining
+ * uncertainty and the size of the meshes. The small meshes are
+ * cheap to be decoded fully, and the middle LODs hardly narrow
+ * the pairs which are almost certain, so both go to the top LOD
+ * directly. The others are refined with the next LOD, or the one
+ * after it if the meshes are not large.
+ * */
+int SpatialJoin::schedule_lod(size_t l, range &r, size_t mesh_size){
+	if(l+2>=lods.size()){
+		return lods[lods.size()-1];
+	}
+	const double uncertainty = r.farthest-r.closest;
+	if(mesh_size<=small_mesh_size||uncertainty<=certain_ratio*r.farthest){
+		return lods[lods.size()-1];
+	}
+	if(mesh_size<=4*small_mesh_size&&uncertainty<=2*certain_ratio*r.farthest){
+		return lods[l+2];
+	}
+	return lods[l+1];
+}
 
-	// now we start to get the distances with progressive level of details
-	if(lods.size()==0){
-		for(int lod = base_lod;lod<=top_lod;lod+=lod_gap){
-			lods.push_back(lod);
+// reschedule the candidates of object o evaluated in round l
+void SpatialJoin::schedule_candidates(candidate_set &candidates, uint o, size_t l){
+	HiMesh_Wrapper *wrapper1 = candidates.object(o);
+	for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+		if(!candidates.candidate_alive(c)||candidates.level(c)>lods[l]){
+			continue;
 		}
-		if(lods[lods.size()-1]<top_lod){
-			lods.push_back(top_lod);
+		// the tightest range among the voxel pairs
+		range r;
+		r.closest = FLT_MAX;
+		r.farthest = FLT_MAX;
+		for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+			if(candidates.pair_alive(p)){
+				r.closest = std::min(r.closest, candidates.pair(p).dist.closest);
+				r.farthest = std::min(r.farthest, candidates.pair(p).dist.farthest);
+			}
 		}
+		size_t mesh_size = wrapper1->data_size+candidates.target(c)->data_size;
+		candidates.set_level(c, schedule_lod(l, r, mesh_size));
 	}
+}
 
+/*
+ * for the approximate join, whether the true distance is known
+ * within the tolerance by range r. The ranges are squared while
+ * the tolerances are on the distances.
+ * */
+bool SpatialJoin::within_tolerance(range &r){
+	const float lo = sqrt(std::max(r.closest, (float)0));
+	const float hi = sqrt(std::max(r.farthest, (float)0));
+	return hi-lo<=abs_tolerance||hi-lo<=rel_tolerance*hi;
+}
 
-	for(int lod:lods){
-		struct timeval iter_start = get_cur_time();
-		const int pair_num = get_pair_num(candidates);
-		if(pair_num==0){
-			break;
+// for the approximate nearest neighbor join, report the candidate of
+// object o with the nearest upper bound once the distance to the
+// nearest neighbor is within the tolerance, with the interval of it
+bool SpatialJoin::settle_approximate(Tile *tile1, Tile *tile2, candidate_set &candidates, uint o){
+	range bound;
+	bound.closest = FLT_MAX;
+	bound.farthest = FLT_MAX;
+	uint nearest = UINT_MAX;
+	for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+		if(!candidates.candidate_alive(c)){
+			continue;
 		}
-		uint *offset_size = new uint[4*pair_num];
-		float *distances = new float[pair_num];
-		size_t candidate_num = get_candidate_num(candidates);
-		log("%ld polyhedron has %d candidates %f voxel pairs per candidate", candidates.size(), candidate_num, (1.0*pair_num)/candidates.size());
-		// retrieve the necessary meshes
-		map<Voxel *, std::pair<uint, uint>> voxel_map;
-		uint segment_num = 0;
-		size_t segment_pair_num = 0;
+		for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+			if(!candidates.pair_alive(p)){
+				continue;
+			}
+			range &d = candidates.pair(p).dist;
+			bound.closest = std::min(bound.closest, d.closest);
+			if(d.farthest<bound.farthest){
+				bound.farthest = d.farthest;
+				nearest = c;
+			}
+		}
+	}
+	if(nearest==UINT_MAX||!within_tolerance(bound)){
+		return false;
+	}
+	emit_result(sink, tile1, tile2, candidates.object(o), candidates.target(nearest), bound);
+	candidates.remove_object(o);
+	return true;
+}
+
+/*
+ *
+ * for the within distance join
+ *
+ * */
 
-		int candidate_length = 0;
-		for(candidate_entry &e:candidates){
-			for(candidate_info &i:e.second){
-				candidate_length += i.voxel_pairs.size();
+void *mbb_within_unit(void *arg){
+	filter_param *fp = (filter_param *)arg;
+	candidate_set &candidates = fp->candidates;
+	Tile *tile2 = fp->tile2;
+	// the ranges are in squared distance
+	const float dd = fp->distance*fp->distance;
+	vector<int> candidate_ids;
+	for(int i=fp->begin;i<fp->end;i++){
+		HiMesh_Wrapper *wrapper1 = fp->tile1->get_mesh_wrapper(i);
+		// the objects within distance intersect the extended box
+		weighted_aab probe = wrapper1->box;
+		for(int k=0;k<3;k++){
+			probe.box.min[k] -= fp->distance;
+			probe.box.max[k] += fp->distance;
+		}
+		fp->tree->query_intersect(&probe, candidate_ids);
+		if(candidate_ids.empty()){
+			continue;
+		}
+		std::sort(candidate_ids.begin(), candidate_ids.end());
+		uint o = candidates.begin_object(wrapper1);
+		int former = -1;
+		for(int tile2_id:candidate_ids){
+			if(tile2_id==former||(fp->tile1==tile2&&tile2_id==i)){
+				// duplicate or itself
+				continue;
+			}
+			former = tile2_id;
+			HiMesh_Wrapper *wrapper2 = tile2->get_mesh_wrapper(tile2_id);
+			range dist = wrapper1->box.distance(wrapper2->box);
+			// reject or accept with the mbbs
+			if(dist.closest>dd){
+				continue;
+			}
+			// the farthest of the boxes is the distance of their
+			// centers, accept only if even the far corners are within
+			const float upper = wrapper1->box.box.max_distance(wrapper2->box.box);
+			if(upper<=dd){
+				dist.farthest = upper;
+				emit_result(fp->sink, fp->tile1, tile2, wrapper1, wrapper2, dist);
+				fp->accepted++;
+				continue;
+			}
+			// only the real upper bounds are kept for accepting
+			// the pairs at the later LODs
+			dist.farthest = upper;
+			uint c = candidates.add_candidate(wrapper2, dist);
+			bool within = false;
+			for(Voxel *v1:wrapper1->voxels){
+				for(Voxel *v2:wrapper2->voxels){
+					range tmpd = v1->box.distance(v2->box);
+					const float vupper = v1->box.max_distance(v2->box);
+					if(vupper<=dd){
+						tmpd.closest = dist.closest;
+						tmpd.farthest = vupper;
+						emit_result(fp->sink, fp->tile1, tile2, wrapper1, wrapper2, tmpd);
+						within = true;
+						break;
+					}
+					if(tmpd.closest<=dd){
+						tmpd.farthest = vupper;
+						candidates.add_pair(voxel_pair(v1, v2, tmpd));
+					}
+				}
+				if(within){
+					break;
+				}
+			}
+			if(within){
+				fp->accepted++;
+			}
+			// accepted, or no voxel pair need be further evaluated
+			if(within||candidates.num_pairs(c)==0){
+				candidates.remove_candidate(o, c);
 			}
 		}
+		candidate_ids.clear();
+		candidates.end_object();
+	}
+	return NULL;
+}
+
+size_t SpatialJoin::mbb_within(Tile *tile1, Tile *tile2, candidate_set &candidates){
+	return probe_objects(tile1, tile2, candidates, mbb_within_unit, pool, within_distance, 1, sink);
+}
 
-		for(candidate_entry &c:candidates){
-			// the nearest neighbor is found
-			if(c.second.size()<=1){
+/*
+ * update the voxel pairs with the distances computed at a LOD, the
+ * candidates with any voxel pair within the distance are accepted,
+ * and the others are rejected after evaluated at the top LOD. The
+ * number of the accepted ones is returned.
+ * */
+size_t SpatialJoin::update_candidate_list_within(Tile *tile1, Tile *tile2, candidate_set &candidates,
+		uint *offset_size, float *distances, bool top){
+	const float dd = within_distance*within_distance;
+	size_t accepted = 0;
+	int index = 0;
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(!candidates.object_alive(o)){
+			continue;
+		}
+		for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+			if(!candidates.candidate_alive(c)){
 				continue;
 			}
-			HiMesh_Wrapper *wrapper1 = c.first;
-			for(candidate_info &info:c.second){
-				HiMesh_Wrapper *wrapper2 = info.mesh_wrapper;
-				for(voxel_pair &vp:info.voxel_pairs){
-					assert(vp.v1&&vp.v2);
-					// not filled yet
-					if(vp.v1->data.find(lod)==vp.v1->data.end()){
-						// ensure the mesh is extracted
-						tile1->decode_to(wrapper1->id, lod);
-						wrapper1->fill_voxels(DT_Segment, lod==lods[lods.size()-1]);
+			bool within = false;
+			for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+				if(!candidates.pair_alive(p)){
+					continue;
+				}
+				voxel_pair &vp = candidates.pair(p);
+				if(offset_size[4*index+1]>0&&offset_size[4*index+3]>0){
+					if(top){
+						vp.dist.closest = distances[index];
+						vp.dist.farthest = distances[index];
+					}else{
+						vp.dist.farthest = std::min(vp.dist.farthest, distances[index]);
 					}
-					if(vp.v2->data.find(lod)==vp.v2->data.end()){
-						tile2->decode_to(wrapper2->id, lod);
-						wrapper2->fill_voxels(DT_Segment, lod==lods[lods.size()-1]);
+					within |= vp.dist.farthest<=dd;
+				}
+				index++;
+			}
+			// the ones possibly within the distance are accepted in the
+			// approximate join if known within the tolerance
+			if(!within&&!top&&approximate()){
+				range r = candidates.distance(c);
+				r.closest = FLT_MAX;
+				r.farthest = FLT_MAX;
+				for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+					if(candidates.pair_alive(p)){
+						r.closest = std::min(r.closest, candidates.pair(p).dist.closest);
+						r.farthest = std::min(r.farthest, candidates.pair(p).dist.farthest);
 					}
+				}
+				within = r.closest<=dd&&within_tolerance(r);
+			}
+			if(within){
+				emit_candidate(sink, tile1, tile2, candidates, o, c);
+				accepted++;
+			}
+			// the distances are precise at the top LOD
+			if(within||top){
+				candidates.remove_candidate(o, c);
+			}
+		}
+		if(candidates.num_candidates(o)==0){
+			candidates.remove_object(o);
+		}
+	}
+	return accepted;
+}
 
-					// update the voxel map
-					for(int i=0;i<2;i++){
-						Voxel *tv = i==0?vp.v1:vp.v2;
-						if(voxel_map.find(tv)==voxel_map.end()){
-							std::pair<uint, uint> p;
-							p.first = segment_num;
-							p.second = tv->size[lod];
-							segment_num += tv->size[lod];
-							voxel_map[tv] = p;
-						}
+void SpatialJoin::within(Tile *tile1, Tile *tile2){
+	struct timeval start = get_cur_time();
+	struct timeval very_start = get_cur_time();
+	join_timer timer;
+	// filtering with MBBs and voxels, some are accepted already
+	candidate_set candidates;
+	timer.results += mbb_within(tile1, tile2, candidates);
+	timer.index_time += get_time_elapsed(start, false);
+	logt("comparing mbbs", start);
+	if(window_size>0){
+		stream(tile1, tile2, candidates, JT_distance, timer);
+	}else{
+		prefetch_candidates(tile1, tile2, candidates);
+		voxel_packer packer(tile1, tile2);
+		distance_lods(tile1, tile2, candidates, packer, timer, JT_distance);
+	}
+	log("%ld pairs within distance %f", timer.results, within_distance);
+	add_time(timer, very_start);
+}
+
+/*
+ * get the distances with progressive level of details, for
+ * the nearest neighbor join or the within distance join
+ * */
+void SpatialJoin::distance_lods(Tile *tile1, Tile *tile2, candidate_set &candidates,
+		voxel_packer &packer, join_timer &timer, Join_Type type){
+	struct timeval start = get_cur_time();
+	init_lods();
+	lod_speculator speculator(tile1, tile2, pool);
+
+	for(size_t l=0;l<lods.size();l++){
+		const int lod = lods[l];
+		struct timeval iter_start = get_cur_time();
+		const int pair_num = candidates.pair_num();
+		if(pair_num==0){
+			break;
+		}
+		uint *offset_size = new uint[4*pair_num];
+		float *distances = new float[pair_num];
+		log("%ld polyhedron has %ld candidates %f voxel pairs per candidate", candidates.object_num(),
+				candidates.candidate_num(), (1.0*pair_num)/candidates.object_num());
+		// the slots of the voxels of each pair
+		vector<uint> pair_slots(2*pair_num, UINT_MAX);
+		size_t segment_pair_num = 0;
+
+		// ensure the meshes are extracted and the voxels are filled
+		vector<int> ids1;
+		vector<int> ids2;
+		speculator.join();
+		fill_candidates(tile1, tile2, candidates, lod, DT_Segment,
+				lod==lods[lods.size()-1], ids1, ids2, pool);
+		speculator.settle(ids1, ids2);
+		packer.reset(lod, DT_Segment);
+		int index = 0;
+		for(uint o=0;o<candidates.num_rows();o++){
+			if(!candidates.object_alive(o)){
+				continue;
+			}
+			for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+				// not scheduled for this lod
+				if(candidates.level(c)>lod){
+					index += candidates.num_pairs(c);
+					continue;
+				}
+				for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+					if(!candidates.pair_alive(p)){
+						continue;
 					}
-					segment_pair_num += vp.v1->size[lod]*vp.v2->size[lod];
+					voxel_pair &vp = candidates.pair(p);
+					assert(vp.v1&&vp.v2);
+					uint s1 = packer.add(vp.v1, false);
+					uint s2 = packer.add(vp.v2, true);
+					pair_slots[2*index] = s1;
+					pair_slots[2*index+1] = s2;
+					segment_pair_num += (size_t)packer.get_size(s1)*packer.get_size(s2);
+					index++;
 				}// end for voxel_pairs
 			}// end for distance_candiate list
 		}// end for candidates
-		decode_time += hispeed::get_time_elapsed(start, false);
-		logt("decoded %ld voxels with %d segments %ld segment pairs for lod %d",
-				start, voxel_map.size(), segment_num, segment_pair_num, lod);
+		assert(index==pair_num);
+		size_t segment_num = packer.prefix();
+		timer.decode_time += hispeed::get_time_elapsed(start, false);
+		logt("decoded %ld voxels with %ld segments %ld segment pairs for lod %d",
+				start, packer.num_voxels(), segment_num, segment_pair_num, lod);
 		if(segment_pair_num==0){
 			log("no segments is filled in this round");
-			voxel_map.clear();
+			unpin_candidates(tile1, tile2, lod, ids1, ids2);
+			delete []offset_size;
+			delete []distances;
 			continue;
 		}
 //		cerr<<"\ndecoding time\t"<<tile1->decode_time
@@ -274,28 +1160,17 @@ void SpatialJoin::nearest_neighbor(Tile *tile1, Tile *tile2){
 //			<<endl<<endl;
 		tile1->reset_time();
 
-		// now we allocate the space and store the data in a buffer
-		float *data = new float[6*segment_num];
-		for (map<Voxel *, std::pair<uint, uint>>::iterator it=voxel_map.begin();
-				it!=voxel_map.end(); ++it){
-			memcpy(data+it->second.first*6, it->first->data[lod], it->first->size[lod]*6*sizeof(float));
-		}
+		// now store the data in the buffer
+		float *data = packer.pack(hispeed::get_num_threads(), pool);
 		// organize the data for computing
-		int index = 0;
-		for(candidate_entry c:candidates){
-			for(candidate_info info:c.second){
-				for(voxel_pair vp:info.voxel_pairs){
-					assert(vp.v1!=vp.v2);
-					offset_size[4*index] = voxel_map[vp.v1].first;
-					offset_size[4*index+1] = voxel_map[vp.v1].second;
-					offset_size[4*index+2] = voxel_map[vp.v2].first;
-					offset_size[4*index+3] = voxel_map[vp.v2].second;
-					index++;
-				}
-			}
+		for(int i=0;i<pair_num;i++){
+			offset_size[4*i] = packer.get_offset(pair_slots[2*i]);
+			offset_size[4*i+1] = packer.get_size(pair_slots[2*i]);
+			offset_size[4*i+2] = packer.get_offset(pair_slots[2*i+1]);
+			offset_size[4*i+3] = packer.get_size(pair_slots[2*i+1]);
 		}
 		assert(index==pair_num);
-		packing_time += hispeed::get_time_elapsed(start, false);
+		timer.packing_time += hispeed::get_time_elapsed(start, false);
 		logt("organizing data", start);
 		geometry_param gp;
 		gp.data = data;
@@ -303,19 +1178,34 @@ void SpatialJoin::nearest_neighbor(Tile *tile1, Tile *tile2){
 		gp.offset_size = offset_size;
 		gp.distances = distances;
 		gp.data_size = segment_num;
+		// decode the next LOD while computing this one
+		if(pipeline_threads>0&&l+1<lods.size()){
+			speculator.start(candidates, lods[l+1], DT_Segment, l+2==lods.size(), pipeline_threads);
+		}
 		computer->get_distance(gp);
-		computation_time += hispeed::get_time_elapsed(start, false);
+		timer.computation_time += hispeed::get_time_elapsed(start, false);
 		logt("get distance", start);
 
 		// now update the distance range with the new distances
 		index = 0;
-		for(candidate_entry &ce:candidates){
+		if(type==JT_distance){
+			timer.results += update_candidate_list_within(tile1, tile2, candidates, offset_size, distances,
+					lod==lods[lods.size()-1]);
+		}
+		for(uint o=0;o<candidates.num_rows()&&type==JT_nearest;o++){
+			if(!candidates.object_alive(o)){
+				continue;
+			}
 			range min_candidate;
 			min_candidate.farthest = DBL_MAX;
-			for(candidate_info &ci:ce.second){
-				for(voxel_pair &vp:ci.voxel_pairs){
+			for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+				for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+					if(!candidates.pair_alive(p)){
+						continue;
+					}
+					voxel_pair &vp = candidates.pair(p);
 					// update the distance
-					if(vp.v1->size[lod]>0&&vp.v2->size[lod]>0){
+					if(offset_size[4*index+1]>0&&offset_size[4*index+3]>0){
 						range dist = vp.dist;
 						if(lod==lods[lods.size()-1]){
 							// now we have a precise distance
@@ -332,108 +1222,232 @@ void SpatialJoin::nearest_neighbor(Tile *tile1, Tile *tile2){
 					index++;
 				}
 			}
-			update_candidate_list(ce.second, min_candidate);
+			if(knn_k>1){
+				candidates.update_candidates_knn(o, knn_k);
+			}else{
+				candidates.update_candidates(o, min_candidate);
+			}
+			// the nearest neighbors are found, emitted in this round
+			if(candidates.num_candidates(o)<=knn_k){
+				report_object(candidates, o, knn_k, sink, tile1, tile2);
+			}else if(approximate()&&knn_k==1&&settle_approximate(tile1, tile2, candidates, o)){
+				continue;
+			}else if(adaptive_lod){
+				schedule_candidates(candidates, o, l);
+			}
 		}
-		report_candidate(candidates);
-		updatelist_time += hispeed::get_time_elapsed(start, false);
+		candidates.try_compact();
+		timer.released += release_candidates(tile1, tile2, candidates, lod, ids1, ids2);
+		timer.updatelist_time += hispeed::get_time_elapsed(start, false);
 		logt("update candidate list", start);
 
-		delete data;
-		delete offset_size;
-		delete distances;
-		voxel_map.clear();
+		delete []offset_size;
+		delete []distances;
 		logt("current iteration", iter_start);
 
 		if(lod==lods[lods.size()-1]){
 			break;
 		}
 	}
-	pthread_mutex_lock(&g_lock);
-	global_index_time += index_time;
-	global_decode_time += decode_time;
-	global_packing_time += packing_time;
-	global_computation_time += computation_time;
-	global_updatelist_time += updatelist_time;
-	global_total_time += hispeed::get_time_elapsed(very_start, false);
-	pthread_mutex_unlock(&g_lock);
-
+	// the ones still tied after the top LOD
+	if(type==JT_nearest){
+		report_candidate(candidates, knn_k, sink, tile1, tile2, true);
+	}
+	vector<int> none;
+	speculator.settle(none, none);
+	if(speculator.speculated>0){
+		log("%ld objects decoded ahead, %ld discarded", speculator.speculated, speculator.discarded);
+	}
 }
 
-void SpatialJoin::nearest_neighbor_aabb(Tile *tile1, Tile *tile2){
-	struct timeval start = get_cur_time();
-	struct timeval very_start = get_cur_time();
-	double index_time = 0;
-	double decode_time = 0;
-	double packing_time = 0;
-	double computation_time = 0;
-	// filtering with MBBs to get the candidate list
-	vector<candidate_entry> candidates = mbb_distance(tile1, tile2);
-	index_time += hispeed::get_time_elapsed(start, false);
-	logt("comparing mbbs", start);
-
+/*
+ * the iSPEED baseline: the distance between two objects is the
+ * one from the nearest vertex of the first to the segments of
+ * the second, evaluated with the objects decoded to LOD 100.
+ * */
 
-	// generate the aabb tree for all the referred polyhedrons
-	int candidate_size = 0;
-	for(candidate_entry c:candidates){
-		if(c.second.size()<=1){
-			continue;
-		}
-		for(candidate_info info:c.second){
-			HiMesh_Wrapper *wrapper2 = info.mesh_wrapper;
-			tile2->decode_to(wrapper2->id,100);
+// run unit for each of the params, with the tasks in pool if set
+template<class T>
+inline void run_units(task_func unit, vector<T> &params, task_pool *pool){
+	if(params.empty()){
+		return;
+	}
+	if(pool!=NULL){
+		task_group group;
+		for(T &p:params){
+			pool->submit(group, unit, (void *)&p);
 		}
-		tile1->decode_to(c.first->id, 100);
-		candidate_size += c.second.size();
+		pool->wait(group);
+		return;
 	}
-	decode_time += hispeed::get_time_elapsed(start, false);
-	logt("decode data",start);
-	log("%ld polyhedron has %d candidates", candidates.size(), candidate_size);
+	pthread_t threads[params.size()];
+	for(size_t i=1;i<params.size();i++){
+		pthread_create(&threads[i], NULL, unit, (void *)&params[i]);
+	}
+	unit((void *)&params[0]);
+	for(size_t i=1;i<params.size();i++){
+		void *status;
+		pthread_join(threads[i], &status);
+	}
+}
 
-	for(candidate_entry c:candidates){
-		if(c.second.size()<=1){
-			continue;
-		}
-		for(candidate_info info:c.second){
-			HiMesh_Wrapper *wrapper2 = info.mesh_wrapper;
-			wrapper2->mesh->get_aabb_tree();
+class aabb_param{
+public:
+	Tile *tile1 = NULL;
+	Tile *tile2 = NULL;
+	candidate_set *candidates = NULL;
+	// the bvhs of the tile2 objects, indexed by id
+	vector<segment_bvh *> *trees = NULL;
+	vector<int> *ids = NULL;
+	result_sink *sink = NULL;
+	// the rows or the ids in [begin, end)
+	size_t begin = 0;
+	size_t end = 0;
+	size_t queries = 0;
+};
+
+void *bvh_build_unit(void *arg){
+	aabb_param *ap = (aabb_param *)arg;
+	for(size_t i=ap->begin;i<ap->end;i++){
+		int id = (*ap->ids)[i];
+		voxel_buffer *buffer = ap->tile2->get_mesh_wrapper(id)->get_buffer(100);
+		if(buffer!=NULL&&buffer->size>0){
+			(*ap->trees)[id] = new segment_bvh(buffer->data, buffer->size/6);
 		}
 	}
-	packing_time += hispeed::get_time_elapsed(start, false);
-	logt("build aabb tree",start);
+	return NULL;
+}
 
-	for(candidate_entry c:candidates){
-		// the nearest neighbor is found
-		if(c.second.size()<=1){
+void *bvh_nearest_unit(void *arg){
+	aabb_param *ap = (aabb_param *)arg;
+	candidate_set &candidates = *ap->candidates;
+	vector<tuple<float, float, float>> points;
+	vector<float> vertices;
+	vector<pair<float, uint>> order;
+	for(uint o=ap->begin;o<ap->end;o++){
+		if(!candidates.object_alive(o)){
 			continue;
 		}
-		HiMesh_Wrapper *wrapper1 = c.first;
-		double min_dist = DBL_MAX;
-		vector<Point> vertices;
-		wrapper1->mesh->get_vertices(vertices);
-		for(candidate_info info:c.second){
-			HiMesh_Wrapper *wrapper2 = info.mesh_wrapper;
-			int index = 0;
-			for(Point &p:vertices){
-				FT sqd = wrapper2->mesh->get_aabb_tree()->squared_distance(p);
-				double distance = (double)CGAL::to_double(sqd);
-				if(min_dist>distance){
-					min_dist = distance;
+		HiMesh_Wrapper *wrapper1 = candidates.object(o);
+		voxel_buffer *buffer = wrapper1->get_buffer(100);
+		if(buffer==NULL||buffer->size==0){
+			continue;
+		}
+		// the vertices are the distinct end points of the segments
+		for(size_t i=0;i<buffer->size;i+=3){
+			points.push_back(std::make_tuple(buffer->data[i], buffer->data[i+1], buffer->data[i+2]));
+		}
+		std::sort(points.begin(), points.end());
+		points.erase(std::unique(points.begin(), points.end()), points.end());
+		for(tuple<float, float, float> &p:points){
+			vertices.push_back(std::get<0>(p));
+			vertices.push_back(std::get<1>(p));
+			vertices.push_back(std::get<2>(p));
+		}
+		// the candidates in the order of their mbb distances, the
+		// ones not nearer than the best one found are skipped
+		for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+			if(candidates.candidate_alive(c)){
+				order.push_back(pair<float, uint>(candidates.distance(c).closest, c));
+			}
+		}
+		std::sort(order.begin(), order.end());
+		HiMesh_Wrapper *nearest = NULL;
+		float min_dist = FLT_MAX;
+		for(pair<float, uint> &oc:order){
+			if(oc.first>=min_dist){
+				break;
+			}
+			HiMesh_Wrapper *wrapper2 = candidates.target(oc.second);
+			segment_bvh *tree = (*ap->trees)[wrapper2->id];
+			if(tree==NULL){
+				continue;
+			}
+			for(size_t i=0;i<vertices.size();i+=3){
+				float dist = tree->nearest(&vertices[i], min_dist);
+				if(dist<min_dist){
+					min_dist = dist;
+					nearest = wrapper2;
 				}
 			}
-		}// end for distance_candiate list
+			ap->queries += vertices.size()/3;
+		}
+		if(nearest!=NULL){
+			range dist;
+			dist.closest = min_dist;
+			dist.farthest = min_dist;
+			emit_result(ap->sink, ap->tile1, ap->tile2, wrapper1, nearest, dist);
+		}
+		points.clear();
 		vertices.clear();
-	}// end for candidates
-	computation_time += hispeed::get_time_elapsed(start, false);
-	logt("getting distance", start);
+		order.clear();
+	}
+	return NULL;
+}
 
-	pthread_mutex_lock(&g_lock);
-	global_index_time += index_time;
-	global_decode_time += decode_time;
-	global_packing_time += packing_time;
-	global_computation_time += computation_time;
-	global_total_time += hispeed::get_time_elapsed(very_start, false);
-	pthread_mutex_unlock(&g_lock);
+void SpatialJoin::nearest_neighbor_aabb(Tile *tile1, Tile *tile2){
+	// the BVH pass keeps the nearest target only
+	assert(knn_k==1);
+	struct timeval start = get_cur_time();
+	struct timeval very_start = get_cur_time();
+	join_timer timer;
+	// filtering with MBBs to get the candidate list
+	candidate_set candidates;
+	mbb_distance(tile1, tile2, candidates);
+	timer.index_time += hispeed::get_time_elapsed(start, false);
+	logt("comparing mbbs", start);
+	report_candidate(candidates, knn_k, sink, tile1, tile2);
+	prefetch_candidates(tile1, tile2, candidates);
+
+	// decode all the referred objects to the top LOD
+	vector<int> ids1;
+	vector<int> ids2;
+	fill_candidates(tile1, tile2, candidates, 100, DT_Segment, true, ids1, ids2, pool);
+	timer.decode_time += hispeed::get_time_elapsed(start, false);
+	logt("decode data",start);
+	log("%ld polyhedron has %ld candidates", candidates.object_num(), candidates.candidate_num());
+
+	const int num_threads = pool!=NULL?pool->num_threads():hispeed::get_num_threads();
+	vector<segment_bvh *> trees(tile2->num_objects(), NULL);
+	vector<aabb_param> params(std::min((size_t)num_threads, ids2.size()));
+	for(size_t i=0;i<params.size();i++){
+		params[i].tile2 = tile2;
+		params[i].trees = &trees;
+		params[i].ids = &ids2;
+		params[i].begin = ids2.size()*i/params.size();
+		params[i].end = ids2.size()*(i+1)/params.size();
+	}
+	run_units(bvh_build_unit, params, pool);
+	timer.packing_time += hispeed::get_time_elapsed(start, false);
+	logt("build bvh", start);
 
+	// the objects take various time, split them finer than the threads
+	params.clear();
+	params.resize(std::min((size_t)4*num_threads, (size_t)candidates.num_rows()));
+	for(size_t i=0;i<params.size();i++){
+		params[i].tile1 = tile1;
+		params[i].tile2 = tile2;
+		params[i].candidates = &candidates;
+		params[i].trees = &trees;
+		params[i].sink = sink;
+		params[i].begin = (size_t)candidates.num_rows()*i/params.size();
+		params[i].end = (size_t)candidates.num_rows()*(i+1)/params.size();
+	}
+	run_units(bvh_nearest_unit, params, pool);
+	size_t queries = 0;
+	for(aabb_param &ap:params){
+		queries += ap.queries;
+	}
+	timer.computation_time += hispeed::get_time_elapsed(start, false);
+	logt("getting distance with %ld point queries", start, queries);
+
+	for(segment_bvh *tree:trees){
+		if(tree!=NULL){
+			delete tree;
+		}
+	}
+	unpin_candidates(tile1, tile2, 100, ids1, ids2);
+	add_time(timer, very_start);
 }
 
 /*
@@ -442,76 +1456,148 @@ void SpatialJoin::nearest_neighbor_aabb(Tile *tile1, Tile *tile2){
  *
  * */
 
-inline void update_candidate_list_intersect(vector<candidate_entry> &candidates){
-	for(vector<candidate_entry>::iterator it = candidates.begin();it!=candidates.end();){
+/*
+ * for the symmetric self join, each unordered pair is evaluated
+ * once and reported in both directions. As in the join of the
+ * ordered pairs, an object is settled in the round it is known to
+ * intersect any other, which is marked in intersected, and is not
+ * reported in the later rounds. The pairs between two settled
+ * objects are removed without further evaluation
+ * */
+inline void update_candidate_list_symmetric(candidate_set &candidates,
+		result_sink *sink, Tile *tile, vector<char> &intersected){
+	range zero;
+	// marked after this round such that all the pairs
+	// confirmed in this round are reported
+	vector<int> settled;
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(!candidates.object_alive(o)){
+			continue;
+		}
+		HiMesh_Wrapper *wrapper1 = candidates.object(o);
+		for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+			if(!candidates.candidate_alive(c)){
+				continue;
+			}
+			for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+				if(candidates.pair_alive(p)&&candidates.pair(p).intersect){
+					HiMesh_Wrapper *wrapper2 = candidates.target(c);
+					if(!intersected[wrapper1->id]){
+						emit_result(sink, tile, tile, wrapper1, wrapper2, zero);
+					}
+					if(wrapper2!=wrapper1&&!intersected[wrapper2->id]){
+						emit_result(sink, tile, tile, wrapper2, wrapper1, zero);
+					}
+					settled.push_back(wrapper1->id);
+					settled.push_back(wrapper2->id);
+					candidates.remove_candidate(o, c);
+					break;
+				}
+			}
+		}
+	}
+	for(int id:settled){
+		intersected[id] = true;
+	}
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(!candidates.object_alive(o)){
+			continue;
+		}
+		if(intersected[candidates.object(o)->id]){
+			for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+				if(candidates.candidate_alive(c)&&intersected[candidates.target(c)->id]){
+					candidates.remove_candidate(o, c);
+				}
+			}
+		}
+		if(candidates.num_candidates(o)==0){
+			candidates.remove_object(o);
+		}
+	}
+}
+
+// the candidates intersected are emitted, and the objects
+// intersecting any of them are removed
+inline void update_candidate_list_intersect(candidate_set &candidates,
+		result_sink *sink, Tile *tile1, Tile *tile2, vector<char> *intersected){
+	if(intersected!=NULL){
+		assert(tile1==tile2);
+		update_candidate_list_symmetric(candidates, sink, tile1, *intersected);
+		return;
+	}
+	range zero;
+	for(uint o=0;o<candidates.num_rows();o++){
+		if(!candidates.object_alive(o)){
+			continue;
+		}
 		bool intersected = false;
-		for(candidate_info &info:it->second){
-			for(voxel_pair &vp:info.voxel_pairs){
+		for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+			if(!candidates.candidate_alive(c)){
+				continue;
+			}
+			for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
 				// if any voxel pair is ensured to be intersected
-				if(vp.intersect){
+				if(candidates.pair_alive(p)&&candidates.pair(p).intersect){
+					emit_result(sink, tile1, tile2, candidates.object(o), candidates.target(c), zero);
 					intersected = true;
 					break;
 				}
 			}
-			if(intersected){
+			// no need to check the rest without a sink
+			if(intersected&&sink==NULL){
 				break;
 			}
 		}
 		if(intersected){
-			for(candidate_info &info:it->second){
-				info.voxel_pairs.clear();
-			}
-			it->second.clear();
-			it = candidates.erase(it);
-		}else{
-			it++;
+			candidates.remove_object(o);
 		}
 	}
 }
 
-vector<candidate_entry> SpatialJoin::mbb_intersect(Tile *tile1, Tile *tile2){
-	vector<candidate_entry> candidates;
-	OctreeNode *tree = tile2->build_octree(400);
+void *mbb_intersect_unit(void *arg){
+	filter_param *fp = (filter_param *)arg;
+	candidate_set &candidates = fp->candidates;
+	Tile *tile2 = fp->tile2;
 	vector<int> candidate_ids;
-	for(int i=0;i<tile1->num_objects();i++){
-		vector<candidate_info> candidate_list;
-		HiMesh_Wrapper *wrapper1 = tile1->get_mesh_wrapper(i);
-		tree->query_intersect(&(wrapper1->box), candidate_ids);
+	for(int i=fp->begin;i<fp->end;i++){
+		HiMesh_Wrapper *wrapper1 = fp->tile1->get_mesh_wrapper(i);
+		fp->tree->query_intersect(&(wrapper1->box), candidate_ids);
 		if(candidate_ids.empty()){
 			continue;
 		}
 		std::sort(candidate_ids.begin(), candidate_ids.end());
+		uint o = candidates.begin_object(wrapper1);
 		int former = -1;
 		for(int tile2_id:candidate_ids){
-			if(tile2_id==former){
-				// duplicate
+			if(tile2_id==former||(fp->symmetric&&tile2_id<i)){
+				// duplicate, or evaluated from the other side
 				continue;
 			}
 			HiMesh_Wrapper *wrapper2 = tile2->get_mesh_wrapper(tile2_id);
-			candidate_info ci;
-			ci.mesh_wrapper = wrapper2;
+			uint c = candidates.add_candidate(wrapper2, range());
 			for(Voxel *v1:wrapper1->voxels){
 				for(Voxel *v2:wrapper2->voxels){
 					if(v1->box.intersect(v2->box)){
 						// a candidate not sure
-						ci.voxel_pairs.push_back(voxel_pair(v1, v2));
+						candidates.add_pair(voxel_pair(v1, v2));
 					}
 				}
 			}
-			// some voxel pairs need be further evaluated
-			if(ci.voxel_pairs.size()>0){
-				candidate_list.push_back(ci);
+			// no voxel pair need be further evaluated
+			if(candidates.num_pairs(c)==0){
+				candidates.remove_candidate(o, c);
 			}
 			former = tile2_id;
 		}
 		candidate_ids.clear();
-		// save the candidate list
-		candidates.push_back(candidate_entry(wrapper1, candidate_list));
+		candidates.end_object();
 	}
-	delete tree;
-	candidate_ids.clear();
+	return NULL;
+}
 
-	return candidates;
+void SpatialJoin::mbb_intersect(Tile *tile1, Tile *tile2, candidate_set &candidates){
+	probe_objects(tile1, tile2, candidates, mbb_intersect_unit, pool, 0, 1, NULL,
+			symmetric&&tile1==tile2);
 }
 
 /*
@@ -522,79 +1608,87 @@ vector<candidate_entry> SpatialJoin::mbb_intersect(Tile *tile1, Tile *tile2){
 void SpatialJoin::intersect(Tile *tile1, Tile *tile2){
 	struct timeval start = get_cur_time();
 	struct timeval very_start = get_cur_time();
-	double index_time = 0;
-	double decode_time = 0;
-	double packing_time = 0;
-	double updatelist_time = 0;
-	double computation_time = 0;
+	join_timer timer;
 
 	// filtering with MBBs to get the candidate list
-	vector<candidate_entry> candidates = mbb_intersect(tile1, tile2);
-	index_time += hispeed::get_time_elapsed(start,false);
+	candidate_set candidates;
+	mbb_intersect(tile1, tile2, candidates);
+	timer.index_time += hispeed::get_time_elapsed(start,false);
 	logt("comparing mbbs", start);
+	// the objects known to intersect others in a symmetric self join
+	vector<char> settled;
+	vector<char> *intersected = NULL;
+	if(symmetric&&tile1==tile2){
+		settled.resize(tile1->num_objects(), false);
+		intersected = &settled;
+	}
 	// evaluate the candidate list, report and remove the results confirmed
-	update_candidate_list_intersect(candidates);
-	updatelist_time += hispeed::get_time_elapsed(start, false);
+	update_candidate_list_intersect(candidates, sink, tile1, tile2, intersected);
+	timer.updatelist_time += hispeed::get_time_elapsed(start, false);
 	logt("update candidate list", start);
-
-	// now we start to ensure the intersection with progressive level of details
-	size_t triangle_pair_num = 0;
-	double fill_time = 0;
-	if(lods.size()==0){
-		for(int lod = base_lod;lod<=top_lod;lod+=lod_gap){
-			lods.push_back(lod);
-		}
-		if(lods[lods.size()-1]<top_lod){
-			lods.push_back(top_lod);
+	if(window_size>0){
+		stream(tile1, tile2, candidates, JT_intersect, timer, intersected);
+	}else{
+		prefetch_candidates(tile1, tile2, candidates);
+		voxel_packer packer(tile1, tile2);
+		intersect_lods(tile1, tile2, candidates, packer, timer, intersected);
+	}
+	if(intersected!=NULL){
+		for(char i:settled){
+			timer.results += i;
 		}
+		log("%ld objects intersect others", timer.results);
 	}
-	for(int lod:lods){
+	add_time(timer, very_start);
+}
+
+// ensure the intersection with progressive level of details
+void SpatialJoin::intersect_lods(Tile *tile1, Tile *tile2, candidate_set &candidates,
+		voxel_packer &packer, join_timer &timer, vector<char> *intersected){
+	struct timeval start = get_cur_time();
+	size_t triangle_pair_num = 0;
+	init_lods();
+	lod_speculator speculator(tile1, tile2, pool);
+	for(size_t l=0;l<lods.size();l++){
+		const int lod = lods[l];
 		struct timeval iter_start = start;
-		size_t pair_num = get_pair_num(candidates);
+		size_t pair_num = candidates.pair_num();
 		if(pair_num==0){
 			break;
 		}
-		log("%ld polyhedron has %ld candidates", candidates.size(), pair_num);
-		// retrieve the necessary meshes
-		map<Voxel *, std::pair<uint, uint>> voxel_map;
-		size_t triangle_num = 0;
-		for(candidate_entry c:candidates){
-			HiMesh_Wrapper *wrapper1 = c.first;
-			for(candidate_info info:c.second){
-				HiMesh_Wrapper *wrapper2 = info.mesh_wrapper;
-				for(voxel_pair vp:info.voxel_pairs){
-					// not filled yet
-					if(vp.v1->data.find(lod)==vp.v1->data.end()){
-						tile1->decode_to(wrapper1->id, lod);
-						timeval cur = hispeed::get_cur_time();
-						wrapper1->fill_voxels(DT_Triangle, lod==lods[lods.size()-1]);
-						fill_time += hispeed::get_time_elapsed(cur, true);
-					}
-					if(vp.v2->data.find(lod)==vp.v2->data.end()){
-						tile2->decode_to(wrapper2->id, lod);
-						timeval cur = hispeed::get_cur_time();
-						wrapper2->fill_voxels(DT_Triangle, lod==lods[lods.size()-1]);
-						fill_time += hispeed::get_time_elapsed(cur, true);
-					}
-
-					// update the voxel map
-					for(int i=0;i<2;i++){
-						Voxel *tv = i==0?vp.v1:vp.v2;
-						if(voxel_map.find(tv)==voxel_map.end()){
-							std::pair<uint, uint> p;
-							p.first = triangle_num;
-							p.second = tv->size[lod];
-							triangle_num += tv->size[lod];
-							voxel_map[tv] = p;
-						}
+		log("%ld polyhedron has %ld candidates", candidates.object_num(), pair_num);
+		// ensure the meshes are extracted and the voxels are filled
+		vector<int> ids1;
+		vector<int> ids2;
+		speculator.join();
+		fill_candidates(tile1, tile2, candidates, lod, DT_Triangle,
+				lod==lods[lods.size()-1], ids1, ids2, pool);
+		speculator.settle(ids1, ids2);
+		packer.reset(lod, DT_Triangle);
+		// the slots of the voxels of each pair
+		vector<uint> pair_slots(2*pair_num, UINT_MAX);
+		int index = 0;
+		for(uint o=0;o<candidates.num_rows();o++){
+			for(uint c=candidates.cand_begin(o);c<candidates.cand_end(o);c++){
+				for(uint p=candidates.pair_begin(c);p<candidates.pair_end(c);p++){
+					if(!candidates.pair_alive(p)){
+						continue;
 					}
-					triangle_pair_num += vp.v1->size[lod]*vp.v2->size[lod];
+					voxel_pair &vp = candidates.pair(p);
+					uint s1 = packer.add(vp.v1, false);
+					uint s2 = packer.add(vp.v2, true);
+					pair_slots[2*index] = s1;
+					pair_slots[2*index+1] = s2;
+					triangle_pair_num += (size_t)packer.get_size(s1)*packer.get_size(s2);
+					index++;
 				}// end for voxel_pairs
 			}// end for distance_candiate list
 		}// end for candidates
-		decode_time += hispeed::get_time_elapsed(start, false);
+		assert(index==pair_num);
+		size_t triangle_num = packer.prefix();
+		timer.decode_time += hispeed::get_time_elapsed(start, false);
 		logt("decoded %ld voxels with %ld triangles %ld pairs for lod %d",
-				start, voxel_map.size(), triangle_num, triangle_pair_num, lod);
+				start, packer.num_voxels(), triangle_num, triangle_pair_num, lod);
 
 //		cerr<<"\ndecoding time\t"<<tile1->decode_time+tile2->decode_time
 //			<<"\n\tretrieve time\t"<< tile1->retrieve_time+tile2->retrieve_time
@@ -602,178 +1696,237 @@ void SpatialJoin::intersect(Tile *tile1, Tile *tile2){
 //			<<"\n\t\tmalloc time\t"<<tile1->malloc_time+tile2->malloc_time
 //			<<"\n\t\tnewmesh time\t"<<tile1->newmesh_time+tile2->newmesh_time
 //			<<"\n\tadvance time\t"<< tile1->advance_time+tile2->advance_time
-//			<<"\nfilling time\t"<<fill_time
 //			<<endl<<endl;
 		tile1->reset_time();
 		tile2->reset_time();
-		// now we allocate the space and store the data in a buffer
-		float *data = new float[9*triangle_num];
-		for (map<Voxel *, std::pair<uint, uint>>::iterator it=voxel_map.begin();
-				it!=voxel_map.end(); ++it){
-			if(it->first->size[lod]>0){
-				memcpy(data+it->second.first*9, it->first->data[lod], it->first->size[lod]*9*sizeof(float));
-			}
-		}
+		// now store the data in the buffer
+		float *data = packer.pack(hispeed::get_num_threads(), pool);
 		// organize the data for computing
 		uint *offset_size = new uint[4*pair_num];
 		bool *intersect_status = new bool[pair_num];
 		for(int i=0;i<pair_num;i++){
 			intersect_status[i] = false;
-		}
-		int index = 0;
-		for(candidate_entry c:candidates){
-			for(candidate_info info:c.second){
-				for(voxel_pair vp:info.voxel_pairs){
-					offset_size[4*index] = voxel_map[vp.v1].first;
-					offset_size[4*index+1] = voxel_map[vp.v1].second;
-					offset_size[4*index+2] = voxel_map[vp.v2].first;
-					offset_size[4*index+3] = voxel_map[vp.v2].second;
-					index++;
-				}
-			}
+			offset_size[4*i] = packer.get_offset(pair_slots[2*i]);
+			offset_size[4*i+1] = packer.get_size(pair_slots[2*i]);
+			offset_size[4*i+2] = packer.get_offset(pair_slots[2*i+1]);
+			offset_size[4*i+3] = packer.get_size(pair_slots[2*i+1]);
 		}
 		assert(index==pair_num);
-		packing_time += hispeed::get_time_elapsed(start, false);
+		timer.packing_time += hispeed::get_time_elapsed(start, false);
 		logt("organizing data", start);
 		geometry_param gp;
 		gp.data = data;
 		gp.pair_num = pair_num;
 		gp.offset_size = offset_size;
 		gp.intersect = intersect_status;
+		// decode the next LOD while computing this one
+		if(pipeline_threads>0&&l+1<lods.size()){
+			speculator.start(candidates, lods[l+1], DT_Triangle, l+2==lods.size(), pipeline_threads);
+		}
 		computer->get_intersect(gp);
-		computation_time += hispeed::get_time_elapsed(start, false);
+		timer.computation_time += hispeed::get_time_elapsed(start, false);
 		logt("checking intersection", start);
 
 		// now update the intersection status and update the all candidate list
 		// report results if necessary
 		index = 0;
-		for(int i=0;i<candidates.size();i++){
-			for(int j=0;j<candidates[i].second.size();j++){
-				for(int t=0;t<candidates[i].second[j].voxel_pairs.size();t++){
-					// update the status
-					candidates[i].second[j].voxel_pairs[t].intersect |= intersect_status[index++];
-				}
+		for(uint p=0;p<candidates.num_pair_entries();p++){
+			if(candidates.pair_alive(p)){
+				// update the status
+				candidates.pair(p).intersect |= intersect_status[index++];
 			}
 		}
-		update_candidate_list_intersect(candidates);
-		updatelist_time += hispeed::get_time_elapsed(start, false);
+		update_candidate_list_intersect(candidates, sink, tile1, tile2, intersected);
+		candidates.try_compact();
+		timer.released += release_candidates(tile1, tile2, candidates, lod, ids1, ids2);
+		timer.updatelist_time += hispeed::get_time_elapsed(start, false);
 		logt("update candidate list", start);
 
-		delete []data;
 		delete []offset_size;
 		delete []intersect_status;
-		voxel_map.clear();
 
 		logt("current iteration", iter_start);
 	}
-
-	pthread_mutex_lock(&g_lock);
-	global_index_time += index_time;
-	global_decode_time += decode_time;
-	global_packing_time += packing_time;
-	global_computation_time += computation_time;
-	global_updatelist_time += updatelist_time;
-	global_total_time += hispeed::get_time_elapsed(very_start, false);
-	pthread_mutex_unlock(&g_lock);
-
+	vector<int> none;
+	speculator.settle(none, none);
+	if(speculator.speculated>0){
+		log("%ld objects decoded ahead, %ld discarded", speculator.speculated, speculator.discarded);
+	}
 }
 
-
 class nn_param{
 public:
-	pthread_mutex_t lock;
-	queue<pair<Tile *, Tile *>> tile_queue;
-	SpatialJoin *joiner;
-	nn_param(){
-		pthread_mutex_init (&lock, NULL);
-		joiner = NULL;
-	}
+	Tile *tile1 = NULL;
+	Tile *tile2 = NULL;
+	SpatialJoin *joiner = NULL;
+	Join_Type type = JT_nearest;
 	bool ispeed = false;
 };
 
-void *nearest_neighbor_single(void *param){
+// join one tile pair as a task, and delete the tiles after
+void *join_unit(void *param){
 	struct nn_param *nnparam = (struct nn_param *)param;
-	while(!nnparam->tile_queue.empty()){
-		pthread_mutex_lock(&nnparam->lock);
-		if(nnparam->tile_queue.empty()){
-			pthread_mutex_unlock(&nnparam->lock);
-			break;
-		}
-		pair<Tile *, Tile *> p = nnparam->tile_queue.front();
-		nnparam->tile_queue.pop();
-		pthread_mutex_unlock(&nnparam->lock);
-		if(nnparam->ispeed){
-			p.first->disable_innerpart();
-			p.second->disable_innerpart();
-			nnparam->joiner->nearest_neighbor_aabb(p.first, p.second);
-		}else{
-			nnparam->joiner->nearest_neighbor(p.first, p.second);
-		}
-		if(p.second!=p.first){
-			delete p.second;
-		}
-		delete p.first;
+	Tile *tile1 = nnparam->tile1;
+	Tile *tile2 = nnparam->tile2;
+	if(nnparam->type==JT_intersect){
+		nnparam->joiner->intersect(tile1, tile2);
+	}else if(nnparam->type==JT_distance){
+		nnparam->joiner->within(tile1, tile2);
+	}else if(nnparam->ispeed){
+		tile1->disable_innerpart();
+		tile2->disable_innerpart();
+		nnparam->joiner->nearest_neighbor_aabb(tile1, tile2);
+	}else{
+		nnparam->joiner->nearest_neighbor(tile1, tile2);
+	}
+	if(tile2!=tile1){
+		delete tile2;
 	}
+	delete tile1;
 	return NULL;
 }
 
-void SpatialJoin::nearest_neighbor_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads, bool ispeed){
-	struct nn_param param;
-	for(pair<Tile *, Tile *> &p:tile_pairs){
-		param.tile_queue.push(p);
-	}
-	param.joiner = this;
-	param.ispeed = ispeed;
-	pthread_t threads[num_threads];
-	for(int i=0;i<num_threads;i++){
-		pthread_create(&threads[i], NULL, nearest_neighbor_single, (void *)&param);
+/*
+ * the tile pairs are joined as the coarse tasks in a pool, and the
+ * decoding, packing and computation in them are split into fine grained
+ * tasks, such that the idle threads help with the skewed tile pairs
+ * instead of waiting for the computer taken by one pair.
+ * */
+void SpatialJoin::join_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads,
+		Join_Type type, bool ispeed){
+	assert(pool==NULL&&num_threads>0);
+	pool = new task_pool(num_threads);
+	computer->set_pool(pool);
+	vector<nn_param> params(tile_pairs.size());
+	task_group group;
+	for(size_t i=0;i<tile_pairs.size();i++){
+		params[i].tile1 = tile_pairs[i].first;
+		params[i].tile2 = tile_pairs[i].second;
+		params[i].joiner = this;
+		params[i].type = type;
+		params[i].ispeed = ispeed;
+		pool->submit(group, join_unit, (void *)&params[i], true);
 	}
-	while(!param.tile_queue.empty()){
-		usleep(10);
+	pool->wait(group);
+	computer->set_pool(NULL);
+	pool->report();
+	delete pool;
+	pool = NULL;
+}
+
+void SpatialJoin::nearest_neighbor_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads, bool ispeed){
+	join_batch(tile_pairs, num_threads, JT_nearest, ispeed);
+}
+
+void SpatialJoin::intersect_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads){
+	join_batch(tile_pairs, num_threads, JT_intersect, false);
+}
+
+void SpatialJoin::within_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads, float distance){
+	within_distance = distance;
+	join_batch(tile_pairs, num_threads, JT_distance, false);
+}
+
+class dataset_param{
+public:
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	list<pair<int, int>> pairs;
+	// the tiles being joined by some thread
+	vector<bool> busy1;
+	vector<bool> busy2;
+	Dataset *ds1 = NULL;
+	Dataset *ds2 = NULL;
+	Join_Type type = JT_nearest;
+	SpatialJoin *joiner = NULL;
+	dataset_param(){
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&cond, NULL);
 	}
-	for(int i = 0; i < num_threads; i++){
-		void *status;
-		pthread_join(threads[i], &status);
+	vector<bool> &get_busy2(){
+		return ds1==ds2?busy1:busy2;
 	}
-}
+};
 
-void *intersect_single(void *param){
-	struct nn_param *nnparam = (struct nn_param *)param;
-	while(!nnparam->tile_queue.empty()){
-		pthread_mutex_lock(&nnparam->lock);
-		if(nnparam->tile_queue.empty()){
-			pthread_mutex_unlock(&nnparam->lock);
+// the tile pairs are taken in order, but a tile is never
+// joined by two threads at the same time
+void *join_dataset_single(void *param){
+	dataset_param *dp = (dataset_param *)param;
+	while(true){
+		pthread_mutex_lock(&dp->lock);
+		list<pair<int, int>>::iterator it;
+		while(true){
+			for(it=dp->pairs.begin();it!=dp->pairs.end();it++){
+				if(!dp->busy1[it->first]&&!dp->get_busy2()[it->second]){
+					break;
+				}
+			}
+			if(dp->pairs.empty()||it!=dp->pairs.end()){
+				break;
+			}
+			pthread_cond_wait(&dp->cond, &dp->lock);
+		}
+		if(dp->pairs.empty()){
+			pthread_mutex_unlock(&dp->lock);
 			break;
 		}
-		pair<Tile *, Tile *> p = nnparam->tile_queue.front();
-		nnparam->tile_queue.pop();
-		pthread_mutex_unlock(&nnparam->lock);
-		nnparam->joiner->intersect(p.first, p.second);
-		if(p.second!=p.first){
-			delete p.second;
+		pair<int, int> p = *it;
+		dp->pairs.erase(it);
+		dp->busy1[p.first] = true;
+		dp->get_busy2()[p.second] = true;
+		pthread_mutex_unlock(&dp->lock);
+
+		Tile *tile1 = dp->ds1->open(p.first);
+		Tile *tile2 = dp->ds2->open(p.second);
+		if(dp->type==JT_intersect){
+			dp->joiner->intersect(tile1, tile2);
+		}else if(dp->type==JT_distance){
+			dp->joiner->within(tile1, tile2);
+		}else{
+			dp->joiner->nearest_neighbor(tile1, tile2);
 		}
-		delete p.first;
+		dp->ds1->close(p.first);
+		dp->ds2->close(p.second);
+
+		pthread_mutex_lock(&dp->lock);
+		dp->busy1[p.first] = false;
+		dp->get_busy2()[p.second] = false;
+		pthread_cond_broadcast(&dp->cond);
+		pthread_mutex_unlock(&dp->lock);
 	}
 	return NULL;
 }
 
-void SpatialJoin::intersect_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads){
-	struct nn_param param;
-	for(pair<Tile *, Tile *> &p:tile_pairs){
-		param.tile_queue.push(p);
+void SpatialJoin::join_dataset(Dataset *ds1, Dataset *ds2, Join_Type type, float distance, int num_threads){
+	// the nearest neighbors found in each tile pair are not
+	// merged across the tiles of the other dataset
+	if(type==JT_nearest){
+		log("nearest neighbor join is not supported for datasets");
+		return;
 	}
+	struct timeval start = get_cur_time();
+	dataset_param param;
+	vector<pair<int, int>> pairs;
+	within_distance = distance;
+	ds1->candidate_pairs(ds2, distance, pairs);
+	// the pairs sharing the same tile1 are joined one by one
+	param.pairs.insert(param.pairs.end(), pairs.begin(), pairs.end());
+	param.busy1.resize(ds1->num_tiles(), false);
+	param.busy2.resize(ds2->num_tiles(), false);
+	param.ds1 = ds1;
+	param.ds2 = ds2;
+	param.type = type;
 	param.joiner = this;
+	logt("%ld tile pairs to join", start, pairs.size());
 	pthread_t threads[num_threads];
 	for(int i=0;i<num_threads;i++){
-		pthread_create(&threads[i], NULL, intersect_single, (void *)&param);
+		pthread_create(&threads[i], NULL, join_dataset_single, (void *)&param);
 	}
 	for(int i = 0; i < num_threads; i++){
 		void *status;
 		pthread_join(threads[i], &status);
 	}
+	logt("joined %ld tile pairs", start, pairs.size());
 }
 
-
 }
-
-
@@ -9,38 +9,16 @@
 #define SPATIALJOIN_H_
 
 #include "../storage/tile.h"
+#include "../storage/catalog.h"
 #include "../geometry/geometry.h"
+#include "candidate.h"
+#include "result.h"
 #include <queue>
 
 using namespace std;
 
 namespace hispeed{
 
-class voxel_pair{
-public:
-	Voxel *v1;
-	Voxel *v2;
-	range dist;
-	bool intersect = false;
-	voxel_pair(Voxel *v1, Voxel *v2, range dist){
-		this->v1 = v1;
-		this->v2 = v2;
-		this->dist = dist;
-	};
-	voxel_pair(Voxel *v1, Voxel *v2){
-		this->v1 = v1;
-		this->v2 = v2;
-	}
-};
-
-typedef struct candidate_info_{
-	HiMesh_Wrapper *mesh_wrapper;
-	range distance;
-	vector<voxel_pair> voxel_pairs;
-}candidate_info;
-
-typedef std::pair<HiMesh_Wrapper *, vector<candidate_info>> candidate_entry;
-
 // type of the workers, GPU or CPU
 // each worker took a batch of jobs (X*Y) from the job queue
 // and conduct the join, the result is then stored to
@@ -56,6 +34,64 @@ enum Join_Type{
 	JT_nearest
 };
 
+/*
+ * pack the segments or triangles of the voxels referred by
+ * the candidates into one buffer. The slot of a voxel is
+ * found with its dense index in the tile, and the data is
+ * copied in parallel after the offsets are calculated with
+ * prefix sums. The buffer is reused across rounds.
+ * */
+class voxel_packer{
+	// index of tile2 voxels is shifted by base2
+	size_t base2 = 0;
+	// slot of each voxel in this round, UINT_MAX if not referred
+	vector<uint> slots;
+	// the voxels referred in this round and their indices
+	vector<Voxel *> voxels;
+	vector<size_t> indices;
+	vector<uint> sizes;
+	vector<uint> offsets;
+	float *data = NULL;
+	size_t capacity = 0;
+	size_t data_num = 0;
+	int lod = 0;
+	int datum_size = 6;
+public:
+	voxel_packer(Tile *tile1, Tile *tile2);
+	~voxel_packer();
+	// start a new round
+	void reset(int lod, enum data_type seg_tri);
+	// the slot of voxel v, in tile2 if second is true
+	uint add(Voxel *v, bool second);
+	// calculate the offsets, return the number of segments/triangles
+	size_t prefix();
+	// copy the data into the buffer, with the tasks in pool if set
+	float *pack(int num_threads, task_pool *pool=NULL);
+	size_t num_voxels(){
+		return voxels.size();
+	}
+	uint get_offset(uint slot){
+		return slot==UINT_MAX?0:offsets[slot];
+	}
+	uint get_size(uint slot){
+		return slot==UINT_MAX?0:sizes[slot];
+	}
+};
+
+// the time spent on each step of joining a tile pair
+typedef struct join_timer_{
+	double index_time = 0;
+	double decode_time = 0;
+	double packing_time = 0;
+	double computation_time = 0;
+	double updatelist_time = 0;
+	// number of the pairs found, for the within distance join
+	size_t results = 0;
+	// number of the objects whose voxels are dropped once
+	// no live candidate refers to them
+	size_t released = 0;
+}join_timer;
+
 // size of the buffer is 1GB
 const static long VOXEL_BUFFER_SIZE = 1<<30;
 
@@ -81,14 +117,67 @@ class SpatialJoin{
 	int lod_gap = 50;
 	int top_lod = 100;
 	vector<int> lods;
+	// number of tile1 objects in each window for the
+	// streaming join, 0 for joining the whole tile
+	size_t window_size = 0;
+	// number of threads decoding the next LOD in the
+	// background, 0 for decoding the LODs in turn
+	int pipeline_threads = 0;
+	// the pool running the tasks of the batch joins
+	task_pool *pool = NULL;
+	// schedule the LODs for each candidate instead of
+	// evaluating all of them at every LOD
+	bool adaptive_lod = false;
+	// number of the nearest neighbors of each object
+	uint knn_k = 1;
+	// the distance of the within distance join
+	float within_distance = 0;
+	// stop refining the distance of a pair once its range is
+	// within these tolerances, absolute or relative to the upper
+	// bound, the exact distances are computed if both are 0
+	float abs_tolerance = 0;
+	float rel_tolerance = 0;
+	// evaluate each unordered pair once in the intersection
+	// self join, and report it for both objects
+	bool symmetric = false;
+	// the confirmed pairs are emitted into the sink if set
+	result_sink *sink = NULL;
+	// the meshes of a candidate pair in this size (compressed)
+	// or the ones certain in this ratio go to the top LOD
+	size_t small_mesh_size = 1<<14;
+	float certain_ratio = 0.1;
 	double global_total_time = 0;
 	double global_index_time = 0;
 	double global_decode_time = 0;
 	double global_packing_time = 0;
 	double global_computation_time = 0;
 	double global_updatelist_time = 0;
+	size_t global_results = 0;
+	size_t global_released = 0;
 	pthread_mutex_t g_lock;
 
+	void init_lods();
+	void add_time(join_timer &timer, struct timeval &very_start);
+	// evaluate the candidates with progressive level of details
+	void distance_lods(Tile *tile1, Tile *tile2, candidate_set &candidates,
+			voxel_packer &packer, join_timer &timer, Join_Type type);
+	// the objects known to intersect others are marked in intersected
+	// for the symmetric self join, which is NULL otherwise
+	void intersect_lods(Tile *tile1, Tile *tile2, candidate_set &candidates,
+			voxel_packer &packer, join_timer &timer, vector<char> *intersected);
+	int schedule_lod(size_t l, range &r, size_t mesh_size);
+	void schedule_candidates(candidate_set &candidates, uint o, size_t l);
+	bool within_tolerance(range &r);
+	bool settle_approximate(Tile *tile1, Tile *tile2, candidate_set &candidates, uint o);
+	size_t update_candidate_list_within(Tile *tile1, Tile *tile2, candidate_set &candidates,
+			uint *offset_size, float *distances, bool top);
+	// join the tile pairs with the tasks in a pool
+	void join_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads,
+			Join_Type type, bool ispeed);
+	// evaluate the candidates window by window
+	void stream(Tile *tile1, Tile *tile2, candidate_set &candidates, Join_Type type, join_timer &timer,
+			vector<char> *intersected = NULL);
+
 public:
 	void set_lods(vector<int> &ls){
 		sort(ls.begin(), ls.end());
@@ -109,6 +198,30 @@ public:
 		assert(v>0&&v<=100);
 		lod_gap = v;
 	}
+	void set_window_size(size_t v){
+		window_size = v;
+	}
+	void set_adaptive_lod(bool v){
+		adaptive_lod = v;
+	}
+	void set_symmetric(bool v){
+		symmetric = v;
+	}
+	void set_tolerance(float abs_tol, float rel_tol){
+		assert(abs_tol>=0&&rel_tol>=0);
+		abs_tolerance = abs_tol;
+		rel_tolerance = rel_tol;
+	}
+	bool approximate(){
+		return abs_tolerance>0||rel_tolerance>0;
+	}
+	void set_small_mesh_size(size_t v){
+		small_mesh_size = v;
+	}
+	void set_pipeline_threads(int v){
+		assert(v>=0);
+		pipeline_threads = v;
+	}
 	SpatialJoin(geometry_computer *c){
 		assert(c);
 		pthread_mutex_init(&g_lock, NULL);
@@ -127,15 +240,36 @@ public:
 	 * of the surface (mostly triangle) of a polyhedron.
 	 *
 	 * */
-	vector<candidate_entry> mbb_distance(Tile *tile1, Tile *tile2);
+	void mbb_distance(Tile *tile1, Tile *tile2, candidate_set &candidates);
 	void nearest_neighbor(Tile *tile1, Tile *tile2);
+	// the iSPEED baseline, finds one nearest neighbor only
 	void nearest_neighbor_aabb(Tile *tile1, Tile *tile2);
 
-	vector<candidate_entry> mbb_intersect(Tile *tile1, Tile *tile2);
+	void mbb_intersect(Tile *tile1, Tile *tile2, candidate_set &candidates);
 	void intersect(Tile *tile1, Tile *tile2);
 
+	// all the pairs within within_distance, the ones accepted
+	// by the mbbs or voxels are emitted and not kept
+	size_t mbb_within(Tile *tile1, Tile *tile2, candidate_set &candidates);
+	void within(Tile *tile1, Tile *tile2);
+	void set_knn(uint k){
+		assert(k>0);
+		knn_k = k;
+	}
+	void set_within_distance(float d){
+		within_distance = d;
+	}
+	void set_sink(result_sink *s){
+		sink = s;
+	}
+
 	void nearest_neighbor_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads, bool ispeed);
 	void intersect_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads);
+	void within_batch(vector<pair<Tile *, Tile *>> &tile_pairs, int num_threads, float distance);
+	// join the tile pairs of two datasets whose bounds are within
+	// distance, the tiles are opened when they are joined. Only
+	// the intersection and within distance joins are supported
+	void join_dataset(Dataset *ds1, Dataset *ds2, Join_Type type, float distance, int num_threads);
 
 	/*
 	 *
@@ -0,0 +1,312 @@
+/*
+ * candidate.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <algorithm>
+#include <float.h>
+#include "candidate.h"
+
+namespace hispeed{
+
+uint candidate_set::begin_object(HiMesh_Wrapper *wrapper){
+	objects.push_back(wrapper);
+	cand_start.push_back(targets.size());
+	live_cands.push_back(0);
+	object_dead.push_back(0);
+	live_object_num++;
+	return objects.size()-1;
+}
+
+uint candidate_set::add_candidate(HiMesh_Wrapper *target, range dist){
+	assert(objects.size()>0);
+	targets.push_back(target);
+	distances.push_back(dist);
+	levels.push_back(-1);
+	pair_start.push_back(pairs.size());
+	live_pairs.push_back(0);
+	cand_dead.push_back(0);
+	cand_start.back() = targets.size();
+	live_cands.back()++;
+	live_cand_num++;
+	return targets.size()-1;
+}
+
+void candidate_set::add_pair(voxel_pair vp){
+	assert(targets.size()>0);
+	pairs.push_back(vp);
+	pair_dead.push_back(0);
+	pair_start.back() = pairs.size();
+	live_pairs.back()++;
+	live_pair_num++;
+}
+
+void candidate_set::end_object(){
+	compact_tail();
+}
+
+void candidate_set::append(candidate_set &from, uint o){
+	if(from.object_dead[o]){
+		return;
+	}
+	begin_object(from.objects[o]);
+	for(uint c=from.cand_begin(o);c<from.cand_end(o);c++){
+		if(from.cand_dead[c]){
+			continue;
+		}
+		add_candidate(from.targets[c], from.distances[c]);
+		levels.back() = from.levels[c];
+		for(uint p=from.pair_begin(c);p<from.pair_end(c);p++){
+			if(!from.pair_dead[p]){
+				add_pair(from.pairs[p]);
+			}
+		}
+	}
+}
+
+void candidate_set::append(candidate_set &from){
+	from.compact();
+	const uint cbase = targets.size();
+	const uint pbase = pairs.size();
+	objects.insert(objects.end(), from.objects.begin(), from.objects.end());
+	live_cands.insert(live_cands.end(), from.live_cands.begin(), from.live_cands.end());
+	object_dead.insert(object_dead.end(), from.object_dead.begin(), from.object_dead.end());
+	for(size_t o=1;o<from.cand_start.size();o++){
+		cand_start.push_back(from.cand_start[o]+cbase);
+	}
+	targets.insert(targets.end(), from.targets.begin(), from.targets.end());
+	distances.insert(distances.end(), from.distances.begin(), from.distances.end());
+	levels.insert(levels.end(), from.levels.begin(), from.levels.end());
+	live_pairs.insert(live_pairs.end(), from.live_pairs.begin(), from.live_pairs.end());
+	cand_dead.insert(cand_dead.end(), from.cand_dead.begin(), from.cand_dead.end());
+	for(size_t c=1;c<from.pair_start.size();c++){
+		pair_start.push_back(from.pair_start[c]+pbase);
+	}
+	pairs.insert(pairs.end(), from.pairs.begin(), from.pairs.end());
+	pair_dead.insert(pair_dead.end(), from.pair_dead.begin(), from.pair_dead.end());
+	live_object_num += from.live_object_num;
+	live_cand_num += from.live_cand_num;
+	live_pair_num += from.live_pair_num;
+}
+
+bool candidate_set::update_pairs(uint c, range &d){
+	for(uint p=pair_start[c];p<pair_start[c+1];p++){
+		if(pair_dead[p]){
+			continue;
+		}
+		if(d>pairs[p].dist){
+			return false;
+		}else if(d<pairs[p].dist){
+			// evict this voxel pair
+			remove_pair(c, p);
+		}
+	}
+	return true;
+}
+
+bool candidate_set::update_candidates(uint o, range &d, uint skip){
+	for(uint c=cand_start[o];c<cand_start[o+1];c++){
+		if(cand_dead[c]||c==skip){
+			continue;
+		}
+		if(d>distances[c]){
+			// should not keep since there is a closer one
+			// in the candidate list
+			return false;
+		}else if(d<distances[c]){
+			// one candidate in the list cannot be the closest
+			// remove it, together with the voxels
+			remove_candidate(o, c);
+		}else{
+			// go deep into checking the voxel pairs
+			if(!update_pairs(c, d)){
+				return false;
+			}
+			// current candidate can be removed after comparing the voxel pairs
+			// if all voxel pairs are farther compared to current one
+			if(live_pairs[c]==0){
+				remove_candidate(o, c);
+			}
+		}
+	}
+	// the target one should be kept
+	return true;
+}
+
+void candidate_set::update_candidates_knn(uint o, uint k){
+	// the range of each candidate, from its nearest voxel pairs
+	vector<range> bounds;
+	// the candidates ordered by their farthest distances, and
+	// by the IDs of the targets for the ties
+	vector<std::pair<float, int>> farthest;
+	for(uint c=cand_start[o];c<cand_start[o+1];c++){
+		range r;
+		r.closest = FLT_MAX;
+		r.farthest = FLT_MAX;
+		if(!cand_dead[c]){
+			for(uint p=pair_start[c];p<pair_start[c+1];p++){
+				if(!pair_dead[p]){
+					r.closest = std::min(r.closest, pairs[p].dist.closest);
+					r.farthest = std::min(r.farthest, pairs[p].dist.farthest);
+				}
+			}
+			for(uint p=pair_start[c];p<pair_start[c+1];p++){
+				if(!pair_dead[p]&&pairs[p].dist.closest>r.farthest){
+					remove_pair(c, p);
+				}
+			}
+			farthest.push_back(std::pair<float, int>(r.farthest, targets[c]->id));
+		}
+		bounds.push_back(r);
+	}
+	if(farthest.size()<=k){
+		return;
+	}
+	// k candidates are not farther than the threshold
+	std::nth_element(farthest.begin(), farthest.begin()+k-1, farthest.end());
+	const std::pair<float, int> kth = farthest[k-1];
+	const float threshold = kth.first;
+	for(uint c=cand_start[o];c<cand_start[o+1];c++){
+		if(cand_dead[c]){
+			continue;
+		}
+		range &r = bounds[c-cand_start[o]];
+		// a candidate not nearer than the threshold is at most
+		// tied with the k ones, which win the tie if ordered
+		// before it. Exactly k are left once all are settled
+		if(r.closest>threshold||
+		   (r.closest>=threshold&&std::pair<float, int>(r.farthest, targets[c]->id)>kth)){
+			remove_candidate(o, c);
+		}
+	}
+}
+
+void candidate_set::remove_pair(uint c, uint p){
+	assert(!pair_dead[p]);
+	pair_dead[p] = 1;
+	live_pairs[c]--;
+	live_pair_num--;
+}
+
+void candidate_set::remove_candidate(uint o, uint c){
+	assert(!cand_dead[c]);
+	cand_dead[c] = 1;
+	live_cands[o]--;
+	live_cand_num--;
+	live_pair_num -= live_pairs[c];
+	live_pairs[c] = 0;
+	for(uint p=pair_start[c];p<pair_start[c+1];p++){
+		pair_dead[p] = 1;
+	}
+}
+
+void candidate_set::remove_object(uint o){
+	if(object_dead[o]){
+		return;
+	}
+	for(uint c=cand_start[o];c<cand_start[o+1];c++){
+		if(!cand_dead[c]){
+			remove_candidate(o, c);
+		}
+	}
+	object_dead[o] = 1;
+	live_object_num--;
+}
+
+size_t candidate_set::pair_num(uint o){
+	size_t num = 0;
+	for(uint c=cand_start[o];c<cand_start[o+1];c++){
+		num += live_pairs[c];
+	}
+	return num;
+}
+
+void candidate_set::compact_tail(){
+	assert(objects.size()>0);
+	const uint o = objects.size()-1;
+	uint cw = cand_start[o];
+	uint pw = pair_start[cw];
+	for(uint c=cand_start[o];c<cand_start[o+1];c++){
+		if(cand_dead[c]){
+			continue;
+		}
+		uint begin = pw;
+		for(uint p=pair_start[c];p<pair_start[c+1];p++){
+			if(!pair_dead[p]){
+				pairs[pw] = pairs[p];
+				pair_dead[pw++] = 0;
+			}
+		}
+		targets[cw] = targets[c];
+		distances[cw] = distances[c];
+		levels[cw] = levels[c];
+		live_pairs[cw] = live_pairs[c];
+		cand_dead[cw] = 0;
+		pair_start[cw] = begin;
+		cw++;
+	}
+	targets.resize(cw);
+	distances.resize(cw);
+	levels.resize(cw);
+	live_pairs.resize(cw);
+	cand_dead.resize(cw);
+	pair_start.resize(cw+1);
+	pair_start[cw] = pw;
+	pairs.erase(pairs.begin()+pw, pairs.end());
+	pair_dead.resize(pw);
+	cand_start[o+1] = cw;
+}
+
+void candidate_set::compact(){
+	uint ow = 0;
+	uint cw = 0;
+	uint pw = 0;
+	for(uint o=0;o<objects.size();o++){
+		if(object_dead[o]){
+			continue;
+		}
+		uint cbegin = cw;
+		for(uint c=cand_start[o];c<cand_start[o+1];c++){
+			if(cand_dead[c]){
+				continue;
+			}
+			uint pbegin = pw;
+			for(uint p=pair_start[c];p<pair_start[c+1];p++){
+				if(!pair_dead[p]){
+					pairs[pw] = pairs[p];
+					pair_dead[pw++] = 0;
+				}
+			}
+			targets[cw] = targets[c];
+			distances[cw] = distances[c];
+			levels[cw] = levels[c];
+			live_pairs[cw] = live_pairs[c];
+			cand_dead[cw] = 0;
+			// the start of c is not read anymore
+			pair_start[cw] = pbegin;
+			cw++;
+		}
+		objects[ow] = objects[o];
+		live_cands[ow] = live_cands[o];
+		object_dead[ow] = 0;
+		cand_start[ow] = cbegin;
+		ow++;
+	}
+	objects.resize(ow);
+	live_cands.resize(ow);
+	object_dead.resize(ow);
+	cand_start.resize(ow+1);
+	cand_start[ow] = cw;
+	targets.resize(cw);
+	distances.resize(cw);
+	levels.resize(cw);
+	live_pairs.resize(cw);
+	cand_dead.resize(cw);
+	pair_start.resize(cw+1);
+	pair_start[cw] = pw;
+	pairs.erase(pairs.begin()+pw, pairs.end());
+	pair_dead.resize(pw);
+}
+
+}
@@ -0,0 +1,185 @@
+/*
+ * candidate.h
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  the candidates of a join stored as compressed sparse rows:
+ *  the objects in tile1, the candidate objects in tile2 for
+ *  each of them, and the voxel pairs of each candidate. The
+ *  pruned entries are marked dead and removed in batch when
+ *  compacting, such that pruning takes linear time and no
+ *  allocation is needed across the rounds.
+ *
+ */
+
+#ifndef HISPEED_CANDIDATE_H_
+#define HISPEED_CANDIDATE_H_
+
+#include <vector>
+#include <climits>
+#include "../spatial/himesh.h"
+
+using namespace std;
+
+namespace hispeed{
+
+class voxel_pair{
+public:
+	Voxel *v1;
+	Voxel *v2;
+	range dist;
+	bool intersect = false;
+	voxel_pair(Voxel *v1, Voxel *v2, range dist){
+		this->v1 = v1;
+		this->v2 = v2;
+		this->dist = dist;
+	};
+	voxel_pair(Voxel *v1, Voxel *v2){
+		this->v1 = v1;
+		this->v2 = v2;
+	}
+};
+
+class candidate_set{
+	// objects of tile1, the candidates of object o are
+	// within [cand_start[o], cand_start[o+1])
+	vector<HiMesh_Wrapper *> objects;
+	vector<uint> cand_start;
+	vector<uint> live_cands;
+	vector<char> object_dead;
+	// candidates in tile2, the voxel pairs of candidate
+	// c are within [pair_start[c], pair_start[c+1])
+	vector<HiMesh_Wrapper *> targets;
+	vector<range> distances;
+	// the LOD each candidate is evaluated next, -1 for the next round
+	vector<int> levels;
+	vector<uint> pair_start;
+	vector<uint> live_pairs;
+	vector<char> cand_dead;
+	// the voxel pairs
+	vector<voxel_pair> pairs;
+	vector<char> pair_dead;
+
+	size_t live_object_num = 0;
+	size_t live_cand_num = 0;
+	size_t live_pair_num = 0;
+	// remove the dead entries of the last object
+	void compact_tail();
+public:
+	candidate_set(){
+		cand_start.push_back(0);
+		pair_start.push_back(0);
+	}
+
+	/*
+	 * building the rows object by object
+	 * */
+	uint begin_object(HiMesh_Wrapper *wrapper);
+	// add a candidate to the last object
+	uint add_candidate(HiMesh_Wrapper *target, range dist);
+	// add a voxel pair to the last candidate
+	void add_pair(voxel_pair vp);
+	void end_object();
+	// copy the live row of object o in another set
+	void append(candidate_set &from, uint o);
+	// append all the live rows in another set
+	void append(candidate_set &from);
+
+	/*
+	 * pruning
+	 * */
+	// remove the voxel pairs of candidate c which are farther than d,
+	// false if d is farther than any of them
+	bool update_pairs(uint c, range &d);
+	// remove the candidates of object o which are farther than d,
+	// false if d is farther than any of them. skip is the candidate
+	// being evaluated
+	bool update_candidates(uint o, range &d, uint skip = UINT_MAX);
+	// for the k nearest neighbors: remove the voxel pairs farther than
+	// the nearest one of their candidate, and the candidates farther
+	// than the k nearest ones of object o, the ties are broken
+	// by the IDs of the targets
+	void update_candidates_knn(uint o, uint k);
+	void remove_pair(uint c, uint p);
+	void remove_candidate(uint o, uint c);
+	void remove_object(uint o);
+	// remove all the dead entries
+	void compact();
+	// compact when half of the voxel pairs are dead
+	void try_compact(){
+		if(pairs.size()-live_pair_num>live_pair_num){
+			compact();
+		}
+	}
+
+	/*
+	 * accessing
+	 * */
+	uint num_rows(){
+		return objects.size();
+	}
+	bool object_alive(uint o){
+		return !object_dead[o];
+	}
+	HiMesh_Wrapper *object(uint o){
+		return objects[o];
+	}
+	uint cand_begin(uint o){
+		return cand_start[o];
+	}
+	uint cand_end(uint o){
+		return cand_start[o+1];
+	}
+	uint num_candidates(uint o){
+		return live_cands[o];
+	}
+	bool candidate_alive(uint c){
+		return !cand_dead[c];
+	}
+	HiMesh_Wrapper *target(uint c){
+		return targets[c];
+	}
+	range &distance(uint c){
+		return distances[c];
+	}
+	int level(uint c){
+		return levels[c];
+	}
+	void set_level(uint c, int l){
+		levels[c] = l;
+	}
+	uint pair_begin(uint c){
+		return pair_start[c];
+	}
+	uint pair_end(uint c){
+		return pair_start[c+1];
+	}
+	uint num_pairs(uint c){
+		return live_pairs[c];
+	}
+	// number of voxel pairs including the dead ones
+	uint num_pair_entries(){
+		return pairs.size();
+	}
+	bool pair_alive(uint p){
+		return !pair_dead[p];
+	}
+	voxel_pair &pair(uint p){
+		return pairs[p];
+	}
+	size_t object_num(){
+		return live_object_num;
+	}
+	size_t candidate_num(){
+		return live_cand_num;
+	}
+	size_t pair_num(){
+		return live_pair_num;
+	}
+	// number of live voxel pairs of object o
+	size_t pair_num(uint o);
+};
+
+}
+
+#endif /* HISPEED_CANDIDATE_H_ */
@@ -0,0 +1,118 @@
+/*
+ * result.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "result.h"
+#include "../util/util.h"
+
+namespace hispeed{
+
+result_sink::result_sink(size_t bs){
+	assert(bs>0);
+	batch_size = bs;
+	pthread_mutex_init(&lock, NULL);
+	pthread_key_create(&key, NULL);
+}
+
+result_sink::~result_sink(){
+	// the subclass closes the sink before its file is closed
+	for(vector<join_result> *buffer:buffers){
+		assert(buffer->empty());
+		delete buffer;
+	}
+	buffers.clear();
+	pthread_key_delete(key);
+}
+
+vector<join_result> *result_sink::get_buffer(){
+	vector<join_result> *buffer = (vector<join_result> *)pthread_getspecific(key);
+	if(buffer==NULL){
+		buffer = new vector<join_result>();
+		buffer->reserve(batch_size);
+		pthread_setspecific(key, buffer);
+		pthread_mutex_lock(&lock);
+		buffers.push_back(buffer);
+		pthread_mutex_unlock(&lock);
+	}
+	return buffer;
+}
+
+void result_sink::flush(vector<join_result> *buffer){
+	if(buffer->empty()){
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	write(buffer->data(), buffer->size());
+	emitted += buffer->size();
+	batches++;
+	pthread_mutex_unlock(&lock);
+	buffer->clear();
+}
+
+void result_sink::emit(join_result &r){
+	vector<join_result> *buffer = get_buffer();
+	buffer->push_back(r);
+	if(buffer->size()>=batch_size){
+		flush(buffer);
+	}
+}
+
+void result_sink::close(){
+	for(vector<join_result> *buffer:buffers){
+		flush(buffer);
+	}
+}
+
+void result_sink::report(){
+	log("%ld results emitted in %ld batches", emitted, batches);
+}
+
+binary_sink::binary_sink(string path){
+	fs = fopen(path.c_str(), "wb");
+	if(fs==NULL){
+		log("%s cannot be opened", path.c_str());
+		exit(-1);
+	}
+}
+
+binary_sink::~binary_sink(){
+	close();
+	fclose(fs);
+}
+
+void binary_sink::write(join_result *results, size_t num){
+	fwrite((char *)results, sizeof(join_result), num, fs);
+}
+
+csv_sink::csv_sink(string path){
+	fs = fopen(path.c_str(), "w");
+	if(fs==NULL){
+		log("%s cannot be opened", path.c_str());
+		exit(-1);
+	}
+	fprintf(fs, "tile1,id1,tile2,id2,closest,farthest\n");
+}
+
+csv_sink::~csv_sink(){
+	close();
+	fclose(fs);
+}
+
+void csv_sink::write(join_result *results, size_t num){
+	for(size_t i=0;i<num;i++){
+		join_result &r = results[i];
+		fprintf(fs, "%d,%ld,%d,%ld,%f,%f\n", r.tile1, r.id1, r.tile2, r.id2, r.closest, r.farthest);
+	}
+}
+
+memory_sink::~memory_sink(){
+	close();
+}
+
+void memory_sink::write(join_result *results, size_t num){
+	this->results.insert(this->results.end(), results, results+num);
+}
+
+}
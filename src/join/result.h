@@ -0,0 +1,91 @@
+/*
+ * result.h
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  the sinks the joins emit the confirmed pairs into. Each
+ *  thread batches its results in its own buffer without
+ *  locking, and the full batches are written in turn.
+ *
+ */
+
+#ifndef HISPEED_RESULT_H_
+#define HISPEED_RESULT_H_
+
+#include <pthread.h>
+#include <stdio.h>
+#include <vector>
+#include <string>
+
+using namespace std;
+
+namespace hispeed{
+
+// a pair of objects in the result, the objects are identified
+// with the tags of their tiles and their original IDs. The
+// distance (not squared) is exact if closest equals farthest,
+// otherwise it is known to be within the range
+typedef struct join_result_{
+	int tile1;
+	size_t id1;
+	int tile2;
+	size_t id2;
+	float closest;
+	float farthest;
+}join_result;
+
+class result_sink{
+	pthread_mutex_t lock;
+	// the buffer of each thread
+	pthread_key_t key;
+	vector<vector<join_result> *> buffers;
+	size_t batch_size;
+	vector<join_result> *get_buffer();
+	void flush(vector<join_result> *buffer);
+protected:
+	// write a batch of results, called in turn
+	virtual void write(join_result *results, size_t num) = 0;
+public:
+	size_t emitted = 0;
+	size_t batches = 0;
+	result_sink(size_t bs = 1<<12);
+	virtual ~result_sink();
+	void emit(join_result &r);
+	// write the results left in all the buffers, no
+	// thread should be emitting at the same time
+	void close();
+	void report();
+};
+
+// records of join_result
+class binary_sink:public result_sink{
+	FILE *fs = NULL;
+protected:
+	void write(join_result *results, size_t num);
+public:
+	binary_sink(string path);
+	~binary_sink();
+};
+
+// one line for each result
+class csv_sink:public result_sink{
+	FILE *fs = NULL;
+protected:
+	void write(join_result *results, size_t num);
+public:
+	csv_sink(string path);
+	~csv_sink();
+};
+
+// kept in memory, for checking the results
+class memory_sink:public result_sink{
+protected:
+	void write(join_result *results, size_t num);
+public:
+	vector<join_result> results;
+	~memory_sink();
+};
+
+}
+
+#endif /* HISPEED_RESULT_H_ */
@@ -292,8 +292,9 @@ void HiMesh::advance_to(int lod){
 
 
 // the function to generate the segments(0) or triangle(1) and
-// assign each segment(0) or triangle(1) to the proper voxel
-void HiMesh::fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle){
+// assign each segment(0) or triangle(1) to the proper voxel.
+// the data of all the voxels are stored in one buffer
+voxel_buffer *HiMesh::fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle){
 	assert(voxels.size()>0);
 
 	size_t num_of_data = 0;
@@ -302,7 +303,7 @@ void HiMesh::fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle)
 	int lod = i_decompPercentage;
 	// the voxel should not be filled
 	if(voxels[0]->data.find(lod)!=voxels[0]->data.end()){
-		return;
+		return NULL;
 	}
 	if(seg_or_triangle==DT_Segment){
 		num_of_data = size_of_edges();
@@ -315,16 +316,15 @@ void HiMesh::fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle)
 		data_buffer = new float[num_of_data*size_of_datum];
 		fill_triangles(data_buffer);
 	}
+	voxel_buffer *buffer = new voxel_buffer(voxels.size(), size_of_datum);
+	buffer->size = num_of_data*size_of_datum;
 
 	// for the special case only one voxel exist
 	if(voxels.size()==1){
-		voxels[0]->size[lod] = num_of_data;
-		voxels[0]->data[lod] = new float[num_of_data*size_of_datum];
-		memcpy(voxels[0]->data[lod],
-			   data_buffer,
-			   num_of_data*size_of_datum*sizeof(float));
-		delete []data_buffer;
-		return;
+		buffer->data = data_buffer;
+		buffer->counts[0] = num_of_data;
+		buffer->attach(voxels, lod);
+		return buffer;
 	}
 
 	// now reorganize the data with the voxel information given
@@ -332,12 +332,6 @@ void HiMesh::fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle)
 	// we tried voronoi graph, but for some reason it's
 	// even slower than the brute force method
 	int *groups = new int[num_of_data];
-	int *group_count = new int[voxels.size()];
-	for(int i=0;i<voxels.size();i++){
-		voxels[i]->size[lod] = 0;
-		voxels[i]->data[lod] = NULL;
-		group_count[i] = 0;
-	}
 	for(int i=0;i<num_of_data;i++){
 		// for both segment and triangle, we assign it with only the first
 		// point
@@ -352,28 +346,28 @@ void HiMesh::fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle)
 			}
 		}
 		groups[i] = gid;
-		group_count[gid]++;
+		buffer->counts[gid]++;
 	}
 
-
-	for(int i=0;i<voxels.size();i++){
-		if(group_count[i]>0){
-			voxels[i]->data[lod] = new float[group_count[i]*size_of_datum];
-		}
+	// the data of each voxel starts after the former ones
+	for(int i=1;i<voxels.size();i++){
+		buffer->offsets[i] = buffer->offsets[i-1]+buffer->counts[i-1];
 	}
 
-	// copy the data to the proper position in the segment_buffer
+	// copy the data to the proper position in the buffer
+	buffer->data = new float[num_of_data*size_of_datum];
+	vector<size_t> cur_offsets = buffer->offsets;
 	for(int i=0;i<num_of_data;i++){
-		Voxel *v = voxels[groups[i]];
-		memcpy((void *)(v->data[lod]+v->size[lod]*size_of_datum),
+		memcpy((void *)(buffer->data+cur_offsets[groups[i]]*size_of_datum),
 			   (void *)(data_buffer+i*size_of_datum),
 			   size_of_datum*sizeof(float));
-		v->size[lod]++;
+		cur_offsets[groups[i]]++;
 	}
+	buffer->attach(voxels, lod);
 
-	delete groups;
-	delete group_count;
-	delete data_buffer;
+	delete []groups;
+	delete []data_buffer;
+	return buffer;
 }
 
 HiMesh::HiMesh(char* data, long length):
@@ -485,7 +479,11 @@ void HiMesh_Wrapper::fill_voxels(enum data_type seg_tri, bool release_mesh){
 	pthread_mutex_lock(&lock);
 	// mesh could be NULL when multiple threads compete
 	if(mesh){
-		mesh->fill_voxel(voxels, seg_tri);
+		int lod = mesh->i_decompPercentage;
+		voxel_buffer *buffer = mesh->fill_voxel(voxels, seg_tri);
+		if(buffer!=NULL){
+			buffers[lod] = buffer;
+		}
 		// filled the maximum LOD, release the mesh
 		if(release_mesh){
 			delete mesh;
@@ -495,7 +493,15 @@ void HiMesh_Wrapper::fill_voxels(enum data_type seg_tri, bool release_mesh){
 	pthread_mutex_unlock(&lock);
 }
 
-
-
+void HiMesh_Wrapper::attach(int lod, voxel_buffer *buffer){
+	pthread_mutex_lock(&lock);
+	if(buffers.find(lod)==buffers.end()){
+		buffer->attach(voxels, lod);
+		buffers[lod] = buffer;
+	}else{
+		buffer->release();
+	}
+	pthread_mutex_unlock(&lock);
+}
 
 }
@@ -51,23 +51,88 @@ public:
 	~Voxel(){
 		reset();
 	}
+	// the dense index of the voxel in its tile
+	int id = -1;
 	// point which the segments close wiht
 	float core[3];
 	// boundary box of the voxel
 	aab box;
 	// the pointer and size of the segment/triangle data in this voxel
+	// the data is hold by the voxel_buffer of the object
 	map<int, float *> data;
 	map<int, int> size;
 	void reset(){
-		for(map<int, float *>::iterator it=data.begin();it!=data.end();it++){
-			if(it->second!=NULL){
-				delete []it->second;
-				it->second = NULL;
-			}
-		}
 		data.clear();
 		size.clear();
 	}
+	// drop the data of one LOD
+	void reset(int lod){
+		data.erase(lod);
+		size.erase(lod);
+	}
+};
+
+/*
+ * the segments/triangles of all the voxels of an object
+ * at one LOD, grouped by voxel in one buffer. It is
+ * reference counted such that it can be shared by the
+ * wrappers of the same object in different tiles.
+ * */
+class voxel_buffer{
+	int refs = 1;
+public:
+	float *data = NULL;
+	// number of floats in data
+	size_t size = 0;
+	// number of floats of each segment(6) or triangle(9)
+	int datum_size = 0;
+	// offset and number of segments/triangles of each voxel
+	vector<size_t> offsets;
+	vector<int> counts;
+	// called when the last reference is released
+	void (*release_hook)(voxel_buffer *, void *) = NULL;
+	void *hook_arg = NULL;
+
+	voxel_buffer(size_t num_voxels, int ds){
+		datum_size = ds;
+		offsets.resize(num_voxels, 0);
+		counts.resize(num_voxels, 0);
+	}
+	~voxel_buffer(){
+		if(data!=NULL){
+			delete []data;
+		}
+	}
+	// point the voxels to their data in this buffer
+	void attach(vector<Voxel *> &voxels, int lod){
+		assert(voxels.size()==counts.size());
+		for(int i=0;i<voxels.size();i++){
+			voxels[i]->size[lod] = counts[i];
+			voxels[i]->data[lod] = counts[i]>0?data+offsets[i]*datum_size:NULL;
+		}
+	}
+	void retain(){
+		__sync_fetch_and_add(&refs, 1);
+	}
+	// retain unless it is being released
+	bool try_retain(){
+		int cur = refs;
+		while(cur>0){
+			if(__sync_bool_compare_and_swap(&refs, cur, cur+1)){
+				return true;
+			}
+			cur = refs;
+		}
+		return false;
+	}
+	void release(){
+		if(__sync_sub_and_fetch(&refs, 1)==0){
+			if(release_hook!=NULL){
+				release_hook(this, hook_arg);
+			}
+			delete this;
+		}
+	}
 };
 
 enum data_type{
@@ -98,6 +163,10 @@ public:
 	HiMesh(char *data, long length);
 	~HiMesh(){
 		//release_buffer();
+		// the borrowed data is released by its owner
+		if(!own_data){
+			p_data = NULL;
+		}
 		if(aabb_tree){
 			delete aabb_tree;
 			segments.clear();
@@ -114,7 +183,7 @@ public:
 	void to_wkt();
 	float get_volume();
 
-	void fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle);
+	voxel_buffer *fill_voxel(vector<Voxel *> &voxels, enum data_type seg_or_triangle);
 	void get_segments();
 	SegTree *get_aabb_tree();
 
@@ -129,6 +198,19 @@ public:
 		return size_of_halfedges()/2;
 	}
 	void advance_to(int lod);
+
+	// approximate number of bytes taken by the decoded mesh
+	size_t memory_size(){
+		return size_of_vertices()*sizeof(Vertex)+
+			   size_of_halfedges()*sizeof(Halfedge)+
+			   size_of_facets()*sizeof(Facet);
+	}
+
+	// the compressed data is borrowed from an external buffer
+	// (e.g. a memory mapped tile), do not release it with the mesh
+	void borrow_data(){
+		own_data = false;
+	}
 };
 
 
@@ -141,25 +223,49 @@ public:
 class HiMesh_Wrapper{
 public:
 	vector<Voxel *> voxels;
+	// false if the voxels are allocated in bulk by the tile
+	bool own_voxels = true;
+	// the buffers hold the voxel data of each LOD
+	map<int, voxel_buffer *> buffers;
 	bool filled = false;
 	int id = -1;
+	// the ID of the object before the tile is reorganized
+	size_t origin = 0;
 	HiMesh *mesh = NULL;
 	weighted_aab box;
 	// used for retrieving compressed data from disk
 	size_t offset = 0;
 	size_t data_size = 0;
+	// the compressed data fetched in advance
+	char *raw = NULL;
+	// the compressed data is being read synchronously
+	bool loading = false;
 	pthread_mutex_t lock;
+	// held while checking and filling the voxels of a LOD
+	// such that an object is filled once, lock is taken
+	// by the filling itself
+	pthread_mutex_t fill_lock;
 	HiMesh_Wrapper(){
 		pthread_mutex_init(&lock, NULL);
+		pthread_mutex_init(&fill_lock, NULL);
 	}
 	~HiMesh_Wrapper(){
-		for(Voxel *v:voxels){
-			delete v;
+		if(own_voxels){
+			for(Voxel *v:voxels){
+				delete v;
+			}
 		}
 		voxels.clear();
+		for(map<int, voxel_buffer *>::iterator it=buffers.begin();it!=buffers.end();it++){
+			it->second->release();
+		}
+		buffers.clear();
 		if(mesh){
 			delete mesh;
 		}
+		if(raw){
+			delete []raw;
+		}
 	}
 	void writeMeshOff(){
 		assert(mesh);
@@ -177,11 +283,48 @@ public:
 	// seg_tri: 0 for segments, 1 for triangle
 	void fill_voxels(enum data_type seg_tri, bool release_mesh);
 
+	// use the voxel data filled by the wrapper of
+	// the same object in another tile
+	void attach(int lod, voxel_buffer *buffer);
+	bool is_filled(int lod){
+		return buffers.find(lod)!=buffers.end();
+	}
+	voxel_buffer *get_buffer(int lod){
+		map<int, voxel_buffer *>::iterator it = buffers.find(lod);
+		return it==buffers.end()?NULL:it->second;
+	}
+
 	void reset(){
 		pthread_mutex_lock(&lock);
 		for(Voxel *v:voxels){
 			v->reset();
 		}
+		for(map<int, voxel_buffer *>::iterator it=buffers.begin();it!=buffers.end();it++){
+			it->second->release();
+		}
+		buffers.clear();
+		pthread_mutex_unlock(&lock);
+	}
+
+	void reset(int lod){
+		pthread_mutex_lock(&lock);
+		for(Voxel *v:voxels){
+			v->reset(lod);
+		}
+		map<int, voxel_buffer *>::iterator it = buffers.find(lod);
+		if(it!=buffers.end()){
+			it->second->release();
+			buffers.erase(it);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+
+	void release_mesh(){
+		pthread_mutex_lock(&lock);
+		if(mesh){
+			delete mesh;
+			mesh = NULL;
+		}
 		pthread_mutex_unlock(&lock);
 	}
 
@@ -5,6 +5,217 @@
  *      Author: teng
  */
 
+#include <limits.h>
+#include "cache.h"
 
+namespace hispeed{
 
+mesh_cache::~mesh_cache(){
+	for(cache_entry *e:clock){
+		delete e;
+	}
+	clock.clear();
+	entries.clear();
+}
 
+// release the data hold by an entry
+void mesh_cache::release(cache_entry *entry){
+	if(entry->key.lod==CACHE_MESH_LOD){
+		entry->wrapper->release_mesh();
+	}else{
+		entry->wrapper->reset(entry->key.lod);
+	}
+}
+
+// remove the entry from the index and the clock ring
+void mesh_cache::remove(cache_entry *entry){
+	entries.erase(entry->key);
+	size_t slot = entry->slot;
+	assert(slot<clock.size()&&clock[slot]==entry);
+	clock[slot] = clock[clock.size()-1];
+	clock[slot]->slot = slot;
+	clock.pop_back();
+	// wake up the ones waiting for an abandoned entry
+	if(!entry->ready){
+		pthread_cond_broadcast(&filled);
+	}
+}
+
+// an entry is unpinned by one of its holders
+void mesh_cache::unpinned(cache_entry *entry){
+	if(entry->pins>0){
+		return;
+	}
+	if(entry->erased){
+		release(entry);
+		used -= entry->size;
+		remove(entry);
+		delete entry;
+	}else if(used>capacity){
+		evict();
+	}
+}
+
+// evict the entries with the CLOCK algorithm until the
+// used bytes fall in the budget. Two rounds are enough
+// for clearing the reference bits, stop if all the rest
+// entries are pinned
+void mesh_cache::evict(){
+	size_t scanned = 0;
+	while(used>capacity&&scanned<2*clock.size()){
+		if(hand>=clock.size()){
+			hand = 0;
+		}
+		cache_entry *e = clock[hand];
+		scanned++;
+		if(e->pins>0){
+			hand++;
+			continue;
+		}
+		if(e->referenced){
+			e->referenced = false;
+			hand++;
+			continue;
+		}
+		// the hand stays, the last entry is moved in
+		release(e);
+		used -= e->size;
+		evictions++;
+		evicted_bytes += e->size;
+		remove(e);
+		delete e;
+	}
+}
+
+bool mesh_cache::pin(const Tile *tile, HiMesh_Wrapper *w, int lod){
+	bool hit = false;
+	cache_key key(tile, w->id, lod);
+	pthread_mutex_lock(&lock);
+	while(true){
+		map<cache_key, cache_entry *>::iterator it = entries.find(key);
+		if(it==entries.end()){
+			cache_entry *e = new cache_entry(key, w);
+			e->pins = 1;
+			// the mesh is decoded by its own pinners
+			e->ready = (lod==CACHE_MESH_LOD);
+			e->slot = clock.size();
+			clock.push_back(e);
+			entries[key] = e;
+			break;
+		}
+		cache_entry *e = it->second;
+		if(e->ready){
+			e->pins++;
+			e->referenced = true;
+			e->erased = false;
+			hit = true;
+			break;
+		}
+		// reserved and being filled by another caller, which
+		// either marks it ready or abandons it
+		pthread_cond_wait(&filled, &lock);
+	}
+	if(lod!=CACHE_MESH_LOD){
+		if(hit){
+			hits++;
+		}else{
+			misses++;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	return hit;
+}
+
+void mesh_cache::ready(const Tile *tile, int id, int lod){
+	pthread_mutex_lock(&lock);
+	map<cache_key, cache_entry *>::iterator it = entries.find(cache_key(tile, id, lod));
+	assert(it!=entries.end()&&it->second->pins>0);
+	it->second->ready = true;
+	pthread_cond_broadcast(&filled);
+	pthread_mutex_unlock(&lock);
+}
+
+void mesh_cache::unpin(const Tile *tile, int id, int lod){
+	pthread_mutex_lock(&lock);
+	map<cache_key, cache_entry *>::iterator it = entries.find(cache_key(tile, id, lod));
+	assert(it!=entries.end()&&it->second->pins>0);
+	it->second->pins--;
+	unpinned(it->second);
+	pthread_mutex_unlock(&lock);
+}
+
+bool mesh_cache::drop(const Tile *tile, int id, int lod){
+	bool released = false;
+	pthread_mutex_lock(&lock);
+	map<cache_key, cache_entry *>::iterator it = entries.find(cache_key(tile, id, lod));
+	assert(it!=entries.end()&&it->second->pins>0);
+	cache_entry *e = it->second;
+	e->pins--;
+	if(e->pins==0){
+		release(e);
+		used -= e->size;
+		dropped++;
+		remove(e);
+		delete e;
+		released = true;
+	}
+	pthread_mutex_unlock(&lock);
+	return released;
+}
+
+void mesh_cache::resize(const Tile *tile, int id, int lod, size_t size){
+	pthread_mutex_lock(&lock);
+	map<cache_key, cache_entry *>::iterator it = entries.find(cache_key(tile, id, lod));
+	assert(it!=entries.end());
+	used += size;
+	used -= it->second->size;
+	it->second->size = size;
+	if(used>capacity){
+		evict();
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+bool mesh_cache::erase(const Tile *tile, int id){
+	bool erased = true;
+	pthread_mutex_lock(&lock);
+	map<cache_key, cache_entry *>::iterator it = entries.lower_bound(cache_key(tile, id, INT_MIN));
+	while(it!=entries.end()&&it->first.tile==tile&&it->first.id==id){
+		cache_entry *e = it->second;
+		it++;
+		if(e->pins>0){
+			// still used, released by the last unpin
+			e->erased = true;
+			erased = false;
+			continue;
+		}
+		release(e);
+		used -= e->size;
+		remove(e);
+		delete e;
+	}
+	pthread_mutex_unlock(&lock);
+	return erased;
+}
+
+void mesh_cache::erase(const Tile *tile){
+	pthread_mutex_lock(&lock);
+	map<cache_key, cache_entry *>::iterator it = entries.lower_bound(cache_key(tile, INT_MIN, INT_MIN));
+	while(it!=entries.end()&&it->first.tile==tile){
+		cache_entry *e = it->second;
+		it++;
+		assert(e->pins==0);
+		used -= e->size;
+		remove(e);
+		delete e;
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void mesh_cache::report(){
+	size_t total = hits+misses;
+	log("cache: %ld hits %ld misses (%.2f%% hit rate), %ld evictions (%ld MB), %ld dropped, %ld MB in use",
+			hits, misses, total==0?0:100.0*hits/total, evictions, evicted_bytes>>20, dropped, used>>20);
+}
+
+}
@@ -3,6 +3,12 @@
  *
  *  Created on: Dec 26, 2019
  *      Author: teng
+ *
+ *  a byte budgeted cache for the decoded meshes and the
+ *  segments/triangles filled into the voxels for each LOD.
+ *  The entries are evicted with the CLOCK algorithm, the
+ *  ones pinned by a running join are never evicted.
+ *
  */
 
 #ifndef HISPEED_CACHE_H_
@@ -10,23 +16,103 @@
 
 #include <pthread.h>
 #include <vector>
+#include <map>
+#include <tuple>
 #include "../util/util.h"
+#include "../spatial/himesh.h"
 
 using namespace std;
 
 namespace hispeed{
 
+class Tile;
+
+// the LOD used as the key for the decoded mesh itself
+const static int CACHE_MESH_LOD = -1;
+
+typedef struct cache_key_{
+	const Tile *tile;
+	int id;
+	int lod;
+	cache_key_(const Tile *t, int i, int l){
+		tile = t;
+		id = i;
+		lod = l;
+	}
+	bool operator<(const cache_key_ &k) const{
+		return std::tie(tile, id, lod)<std::tie(k.tile, k.id, k.lod);
+	}
+}cache_key;
+
+class cache_entry{
+public:
+	cache_key key;
+	HiMesh_Wrapper *wrapper;
+	size_t size = 0;
+	int pins = 0;
+	// position in the clock ring
+	size_t slot = 0;
+	// the reference bit for the CLOCK algorithm
+	bool referenced = true;
+	// the data is filled by the pinner who reserved it
+	bool ready = false;
+	// erased while pinned, released by the last unpin
+	bool erased = false;
+	cache_entry(cache_key k, HiMesh_Wrapper *w):key(k),wrapper(w){}
+};
 
 class mesh_cache{
-	const size_t capacity;
+	size_t capacity;
+	size_t used = 0;
 	pthread_mutex_t lock;
+	// signaled when a reserved entry is filled or abandoned
+	pthread_cond_t filled;
+	map<cache_key, cache_entry *> entries;
+	// the clock ring and its hand
+	vector<cache_entry *> clock;
+	size_t hand = 0;
+
+	void evict();
+	void release(cache_entry *entry);
+	void remove(cache_entry *entry);
+	void unpinned(cache_entry *entry);
 public:
+	size_t hits = 0;
+	size_t misses = 0;
+	size_t evictions = 0;
+	size_t evicted_bytes = 0;
+	size_t dropped = 0;
+
 	mesh_cache(size_t c){
 		capacity = c;
 		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&filled, NULL);
 	}
+	~mesh_cache();
 
-
+	// pin the entry of object w in tile at lod, return false
+	// if it is not cached yet, in which case an empty entry
+	// is reserved and pinned for the caller to fill and mark
+	// ready. Waits if another caller is still filling it
+	bool pin(const Tile *tile, HiMesh_Wrapper *w, int lod);
+	// the reserved entry is filled
+	void ready(const Tile *tile, int id, int lod);
+	void unpin(const Tile *tile, int id, int lod);
+	// unpin an entry and release its data right away if no
+	// one else pins it, return true if released
+	bool drop(const Tile *tile, int id, int lod);
+	// update the number of bytes taken by an entry
+	void resize(const Tile *tile, int id, int lod, size_t size);
+	// drop all the entries of an object and release their
+	// data, the pinned ones are kept until their last unpin
+	// instead. Return false if any of them is pinned
+	bool erase(const Tile *tile, int id);
+	// drop all the entries of a tile, none can be pinned
+	void erase(const Tile *tile);
+	size_t get_used(){
+		return used;
+	}
+	void report();
 };
 
 }
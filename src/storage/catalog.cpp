@@ -0,0 +1,185 @@
+/*
+ * catalog.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <fstream>
+#include "catalog.h"
+
+namespace hispeed{
+
+bool describe_tile(string path, tile_info &info){
+	if(!hispeed::file_exist(path.c_str())){
+		return false;
+	}
+	Tile *tile = new Tile(path);
+	info.path = path;
+	info.box = tile->get_box();
+	info.num_objects = tile->num_objects();
+	info.num_bytes = hispeed::file_size(path.c_str());
+	delete tile;
+	return true;
+}
+
+bool load_catalog(const char *path, vector<tile_info> &tiles){
+	ifstream is(path);
+	if(!is.is_open()){
+		log("%s cannot be opened", path);
+		return false;
+	}
+	string dir(path);
+	size_t pos = dir.find_last_of('/');
+	dir = pos==string::npos?"":dir.substr(0, pos+1);
+	string line;
+	while(std::getline(is, line)){
+		if(line.size()==0||line[0]=='#'){
+			continue;
+		}
+		stringstream ss(line);
+		tile_info info;
+		ss>>info.path;
+		for(int i=0;i<3;i++){
+			ss>>info.box.min[i];
+		}
+		for(int i=0;i<3;i++){
+			ss>>info.box.max[i];
+		}
+		ss>>info.num_objects>>info.num_bytes;
+		if(ss.fail()){
+			log("invalid line in %s: %s", path, line.c_str());
+			return false;
+		}
+		if(info.path[0]!='/'){
+			info.path = dir+info.path;
+		}
+		tiles.push_back(info);
+	}
+	is.close();
+	return true;
+}
+
+bool persist_catalog(const char *path, vector<tile_info> &tiles){
+	ofstream os(path);
+	if(!os.is_open()){
+		log("%s cannot be opened", path);
+		return false;
+	}
+	os<<"# path min_x min_y min_z max_x max_y max_z objects bytes"<<endl;
+	os.precision(9);
+	for(tile_info &info:tiles){
+		os<<info.path;
+		for(int i=0;i<3;i++){
+			os<<" "<<info.box.min[i];
+		}
+		for(int i=0;i<3;i++){
+			os<<" "<<info.box.max[i];
+		}
+		os<<" "<<info.num_objects<<" "<<info.num_bytes<<endl;
+	}
+	os.close();
+	return true;
+}
+
+Dataset::Dataset(const char *manifest, bool use_mmap){
+	if(!load_catalog(manifest, infos)){
+		exit(-1);
+	}
+	this->use_mmap = use_mmap;
+	tiles.resize(infos.size(), NULL);
+	refs.resize(infos.size(), 0);
+	opening.resize(infos.size(), false);
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&opened_cond, NULL);
+	log("%ld tiles in dataset %s", infos.size(), manifest);
+}
+
+Dataset::~Dataset(){
+	for(Tile *t:tiles){
+		if(t!=NULL){
+			delete t;
+		}
+	}
+	tiles.clear();
+	idle.clear();
+}
+
+// the tile is built out of the lock, the others opening
+// the same tile wait for it
+Tile *Dataset::open(int i){
+	assert(i>=0&&i<infos.size());
+	pthread_mutex_lock(&lock);
+	while(opening[i]){
+		pthread_cond_wait(&opened_cond, &lock);
+	}
+	refs[i]++;
+	if(tiles[i]!=NULL){
+		if(refs[i]==1){
+			idle.remove(i);
+		}
+		reused++;
+		Tile *tile = tiles[i];
+		pthread_mutex_unlock(&lock);
+		return tile;
+	}
+	opening[i] = true;
+	pthread_mutex_unlock(&lock);
+
+	Tile *tile = new Tile(infos[i].path, LONG_MAX, use_mmap);
+	tile->set_cache(cache);
+	tile->set_prefetcher(fetcher);
+	tile->set_sharing(sharing);
+	tile->set_tag(i);
+
+	pthread_mutex_lock(&lock);
+	tiles[i] = tile;
+	opening[i] = false;
+	opened++;
+	pthread_cond_broadcast(&opened_cond);
+	pthread_mutex_unlock(&lock);
+	return tile;
+}
+
+void Dataset::close(int i){
+	assert(i>=0&&i<infos.size());
+	vector<Tile *> victims;
+	pthread_mutex_lock(&lock);
+	assert(refs[i]>0);
+	if(--refs[i]==0){
+		idle.push_back(i);
+		// close the least recently used ones
+		while(idle.size()>max_idle){
+			int victim = idle.front();
+			idle.pop_front();
+			victims.push_back(tiles[victim]);
+			tiles[victim] = NULL;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+	for(Tile *t:victims){
+		delete t;
+	}
+}
+
+void Dataset::candidate_pairs(Dataset *other, float distance, vector<pair<int, int>> &pairs){
+	const float max_dist = distance*distance;
+	for(int i=0;i<infos.size();i++){
+		// both orders of a self join are listed, as the objects
+		// of the first tile are joined with the second
+		for(int j=0;j<other->infos.size();j++){
+			if(infos[i].num_objects==0||other->infos[j].num_objects==0){
+				continue;
+			}
+			// the distances between boxes are squared
+			if(infos[i].box.distance(other->infos[j].box).closest<=max_dist){
+				pairs.push_back(pair<int, int>(i, j));
+			}
+		}
+	}
+}
+
+void Dataset::report(){
+	log("dataset: %ld tiles opened %ld reused", opened, reused);
+}
+
+}
@@ -0,0 +1,98 @@
+/*
+ * catalog.h
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  the catalog of a dataset partitioned into tiles. The
+ *  manifest lists the bounds, number of objects, size and
+ *  path of each tile, one line for each:
+ *
+ *  path min_x min_y min_z max_x max_y max_z objects bytes
+ *
+ *  the relative paths are relative to the manifest. The
+ *  tiles are opened on demand, and at most a given number
+ *  of idle tiles are kept open.
+ *
+ */
+
+#ifndef HISPEED_CATALOG_H_
+#define HISPEED_CATALOG_H_
+
+#include <pthread.h>
+#include <list>
+#include <string>
+#include <vector>
+#include "tile.h"
+
+using namespace std;
+
+namespace hispeed{
+
+typedef struct tile_info_{
+	string path;
+	aab box;
+	size_t num_objects = 0;
+	size_t num_bytes = 0;
+}tile_info;
+
+// get the information of a tile by loading its metadata
+bool describe_tile(string path, tile_info &info);
+bool load_catalog(const char *path, vector<tile_info> &tiles);
+bool persist_catalog(const char *path, vector<tile_info> &tiles);
+
+class Dataset{
+	vector<tile_info> infos;
+	vector<Tile *> tiles;
+	vector<int> refs;
+	// the tiles being built by open
+	vector<bool> opening;
+	// the opened tiles not in use, least recently used first
+	list<int> idle;
+	size_t max_idle = 16;
+	pthread_mutex_t lock;
+	pthread_cond_t opened_cond;
+
+	bool use_mmap = false;
+	mesh_cache *cache = NULL;
+	prefetcher *fetcher = NULL;
+	job_sharing *sharing = NULL;
+public:
+	size_t opened = 0;
+	size_t reused = 0;
+
+	Dataset(const char *manifest, bool use_mmap = false);
+	~Dataset();
+	size_t num_tiles(){
+		return infos.size();
+	}
+	tile_info &get_info(int i){
+		assert(i>=0&&i<infos.size());
+		return infos[i];
+	}
+	void set_max_idle(size_t m){
+		max_idle = m;
+	}
+	void set_cache(mesh_cache *c){
+		cache = c;
+	}
+	void set_prefetcher(prefetcher *p){
+		fetcher = p;
+	}
+	void set_sharing(job_sharing *js){
+		sharing = js;
+	}
+
+	// open tile i or take the opened one, which
+	// should be closed after using
+	Tile *open(int i);
+	void close(int i);
+
+	// the pairs of tiles in this and the other dataset whose bounds
+	// are within distance, in both orders for self join
+	void candidate_pairs(Dataset *other, float distance, vector<pair<int, int>> &pairs);
+	void report();
+};
+
+}
+
+#endif /* HISPEED_CATALOG_H_ */
@@ -5,6 +5,105 @@
  *      Author: teng
  */
 
+#include "job_sharing.h"
 
+namespace hispeed{
 
+job_sharing::~job_sharing(){
+	pthread_mutex_lock(&lock);
+	for(map<job_key, job_entry *>::iterator it=entries.begin();it!=entries.end();it++){
+		// the buffers may outlive the sharing
+		if(it->second->buffer!=NULL){
+			it->second->buffer->release_hook = NULL;
+			it->second->buffer->hook_arg = NULL;
+		}
+		delete it->second;
+	}
+	entries.clear();
+	pthread_mutex_unlock(&lock);
+}
 
+// the buffer is not reachable once the last reference is
+// released, remove it from the sharing
+void job_sharing::on_release(voxel_buffer *buffer, void *arg){
+	job_entry *entry = (job_entry *)arg;
+	job_sharing *js = entry->owner;
+	pthread_mutex_lock(&js->lock);
+	map<job_key, job_entry *>::iterator it = js->entries.find(entry->key);
+	if(it!=js->entries.end()&&it->second==entry){
+		js->entries.erase(it);
+	}
+	pthread_mutex_unlock(&js->lock);
+	delete entry;
+}
+
+voxel_buffer *job_sharing::acquire(const job_key &key){
+	pthread_mutex_lock(&lock);
+	bool waiting = false;
+	while(true){
+		map<job_key, job_entry *>::iterator it = entries.find(key);
+		if(it==entries.end()){
+			break;
+		}
+		job_entry *entry = it->second;
+		if(entry->buffer==NULL){
+			// running by another thread
+			waiting = true;
+			pthread_cond_wait(&done_cond, &lock);
+			continue;
+		}
+		// could fail if the last reference is being released
+		if(entry->buffer->try_retain()){
+			voxel_buffer *buffer = entry->buffer;
+			shared++;
+			if(waiting){
+				waited++;
+			}
+			pthread_mutex_unlock(&lock);
+			return buffer;
+		}
+		// taken over by this thread, the releasing one
+		// will not find it anymore
+		entries.erase(it);
+		break;
+	}
+	job_entry *entry = new job_entry(key);
+	entry->owner = this;
+	entries[key] = entry;
+	decoded++;
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+void job_sharing::publish(const job_key &key, voxel_buffer *buffer){
+	assert(buffer);
+	pthread_mutex_lock(&lock);
+	map<job_key, job_entry *>::iterator it = entries.find(key);
+	assert(it!=entries.end()&&it->second->buffer==NULL);
+	job_entry *entry = it->second;
+	entry->buffer = buffer;
+	buffer->release_hook = on_release;
+	buffer->hook_arg = (void *)entry;
+	pthread_cond_broadcast(&done_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+void job_sharing::abandon(const job_key &key){
+	pthread_mutex_lock(&lock);
+	map<job_key, job_entry *>::iterator it = entries.find(key);
+	if(it!=entries.end()&&it->second->buffer==NULL){
+		delete it->second;
+		entries.erase(it);
+	}
+	pthread_cond_broadcast(&done_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+void job_sharing::report(){
+	pthread_mutex_lock(&lock);
+	log("job sharing: %ld decoded %ld shared (%ld waited) %ld alive",
+			decoded, shared, waited, entries.size());
+	pthread_mutex_unlock(&lock);
+}
+
+}
@@ -3,13 +3,83 @@
  *
  *  Created on: Dec 26, 2019
  *      Author: teng
+ *
+ *  share the decoded segments/triangles of an object among
+ *  the concurrent joins over tiles loaded from the same file,
+ *  such that each object is decoded and filled into voxels
+ *  once for each LOD
+ *
  */
 
-#ifndef JOB_SHARING_H_
-#define JOB_SHARING_H_
+#ifndef HISPEED_JOB_SHARING_H_
+#define HISPEED_JOB_SHARING_H_
+
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <tuple>
+#include "../util/util.h"
+#include "../spatial/himesh.h"
+
+using namespace std;
+
+namespace hispeed{
+
+class job_sharing;
+
+typedef struct job_key_{
+	string path;
+	int id;
+	int lod;
+	int type;
+	job_key_(string p, int i, int l, int t){
+		path = p;
+		id = i;
+		lod = l;
+		type = t;
+	}
+	bool operator<(const job_key_ &k) const{
+		return std::tie(path, id, lod, type)<std::tie(k.path, k.id, k.lod, k.type);
+	}
+}job_key;
+
+class job_entry{
+public:
+	job_key key;
+	// NULL when the job is still running
+	voxel_buffer *buffer = NULL;
+	job_sharing *owner = NULL;
+	job_entry(job_key k):key(k){}
+};
 
+class job_sharing{
+	pthread_mutex_t lock;
+	// signaled when a running job is done
+	pthread_cond_t done_cond;
+	map<job_key, job_entry *> entries;
+	static void on_release(voxel_buffer *buffer, void *arg);
+public:
+	size_t shared = 0;
+	size_t waited = 0;
+	size_t decoded = 0;
 
+	job_sharing(){
+		pthread_mutex_init(&lock, NULL);
+		pthread_cond_init(&done_cond, NULL);
+	}
+	~job_sharing();
 
+	// get a reference to the buffer filled by others, or
+	// NULL in which case the job is reserved for the caller
+	// to do, and it should be published or abandoned later.
+	// wait if the same job is running in another thread
+	voxel_buffer *acquire(const job_key &key);
+	// the buffer is shared until its last reference is released
+	void publish(const job_key &key, voxel_buffer *buffer);
+	void abandon(const job_key &key);
+	void report();
+};
 
+}
 
-#endif /* JOB_SHARING_H_ */
+#endif /* HISPEED_JOB_SHARING_H_ */
@@ -0,0 +1,135 @@
+/*
+ * meta.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "meta.h"
+
+namespace hispeed{
+
+size_t tile_meta::size(size_t num_objects, size_t num_voxels, uint32_t version){
+	return sizeof(meta_header)
+			+((version>2?4:3)*num_objects+1)*sizeof(size_t)
+			+META_VOXEL_COLUMNS*num_voxels*sizeof(float);
+}
+
+bool tile_meta::parse(char *data, size_t length){
+	if(length<sizeof(meta_header)){
+		return false;
+	}
+	header = (meta_header *)data;
+	if(header->magic!=META_MAGIC||
+	   header->version<META_MIN_VERSION||header->version>META_VERSION){
+		return false;
+	}
+	if(length<size(header->num_objects, header->num_voxels, header->version)){
+		return false;
+	}
+	const size_t n = header->num_objects;
+	const size_t v = header->num_voxels;
+	char *cur = data+sizeof(meta_header);
+	offsets = (size_t *)cur;
+	cur += n*sizeof(size_t);
+	data_sizes = (size_t *)cur;
+	cur += n*sizeof(size_t);
+	voxel_starts = (size_t *)cur;
+	cur += (n+1)*sizeof(size_t);
+	origins = NULL;
+	if(header->version>2){
+		origins = (size_t *)cur;
+		cur += n*sizeof(size_t);
+	}
+	for(int i=0;i<META_VOXEL_COLUMNS;i++){
+		columns[i] = (float *)cur;
+		cur += v*sizeof(float);
+	}
+	return voxel_starts[n]==v;
+}
+
+void meta_builder::add_object(size_t offset, size_t data_size, vector<Voxel *> &voxels,
+		const float *shift, long origin){
+	origins.push_back(origin<0?offsets.size():origin);
+	offsets.push_back(offset);
+	data_sizes.push_back(data_size);
+	voxel_starts.push_back(voxel_starts[voxel_starts.size()-1]+voxels.size());
+	for(Voxel *v:voxels){
+		for(int i=0;i<3;i++){
+			float s = shift==NULL?0:shift[i];
+			columns[i].push_back(v->box.min[i]+s);
+			columns[i+3].push_back(v->box.max[i]+s);
+			columns[i+6].push_back(v->core[i]+s);
+		}
+	}
+}
+
+void meta_builder::add_object(size_t offset, size_t data_size, const float *voxels, size_t num_voxels,
+		long origin){
+	origins.push_back(origin<0?offsets.size():origin);
+	offsets.push_back(offset);
+	data_sizes.push_back(data_size);
+	voxel_starts.push_back(voxel_starts[voxel_starts.size()-1]+num_voxels);
+	for(size_t v=0;v<num_voxels;v++){
+		for(int i=0;i<META_VOXEL_COLUMNS;i++){
+			columns[i].push_back(voxels[v*META_VOXEL_COLUMNS+i]);
+		}
+	}
+}
+
+void meta_builder::append(meta_builder &builder, size_t base_offset){
+	size_t voxel_base = voxel_starts[voxel_starts.size()-1];
+	size_t origin_base = offsets.size();
+	for(size_t i=0;i<builder.offsets.size();i++){
+		origins.push_back(builder.origins[i]+origin_base);
+		offsets.push_back(builder.offsets[i]+base_offset);
+		data_sizes.push_back(builder.data_sizes[i]);
+		voxel_starts.push_back(builder.voxel_starts[i+1]+voxel_base);
+	}
+	for(int i=0;i<META_VOXEL_COLUMNS;i++){
+		columns[i].insert(columns[i].end(), builder.columns[i].begin(), builder.columns[i].end());
+	}
+}
+
+char *meta_builder::serialize(size_t &length){
+	meta_header header;
+	header.magic = META_MAGIC;
+	header.version = META_VERSION;
+	header.num_objects = offsets.size();
+	header.num_voxels = columns[0].size();
+	length = tile_meta::size(header.num_objects, header.num_voxels);
+	char *data = new char[length];
+	char *cur = data;
+	memcpy(cur, (char *)&header, sizeof(meta_header));
+	cur += sizeof(meta_header);
+	memcpy(cur, (char *)offsets.data(), offsets.size()*sizeof(size_t));
+	cur += offsets.size()*sizeof(size_t);
+	memcpy(cur, (char *)data_sizes.data(), data_sizes.size()*sizeof(size_t));
+	cur += data_sizes.size()*sizeof(size_t);
+	memcpy(cur, (char *)voxel_starts.data(), voxel_starts.size()*sizeof(size_t));
+	cur += voxel_starts.size()*sizeof(size_t);
+	memcpy(cur, (char *)origins.data(), origins.size()*sizeof(size_t));
+	cur += origins.size()*sizeof(size_t);
+	for(int i=0;i<META_VOXEL_COLUMNS;i++){
+		memcpy(cur, (char *)columns[i].data(), columns[i].size()*sizeof(float));
+		cur += columns[i].size()*sizeof(float);
+	}
+	assert(cur==data+length);
+	return data;
+}
+
+char *meta_builder::serialize_footer(size_t meta_offset, size_t &length){
+	size_t meta_length = 0;
+	char *meta = serialize(meta_length);
+	meta_trailer trailer;
+	trailer.meta_offset = meta_offset;
+	trailer.magic = FOOTER_MAGIC;
+	trailer.version = META_VERSION;
+	length = meta_length+sizeof(meta_trailer);
+	char *data = new char[length];
+	memcpy(data, meta, meta_length);
+	memcpy(data+meta_length, (char *)&trailer, sizeof(meta_trailer));
+	delete []meta;
+	return data;
+}
+
+}
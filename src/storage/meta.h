@@ -0,0 +1,122 @@
+/*
+ * meta.h
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  the versioned format of the metadata of a tile. The
+ *  offsets, sizes and voxel boxes are stored as
+ *  contiguous columns, which can be mapped into memory
+ *  and used without parsing each element:
+ *
+ *  header | offset[n] | data_size[n] | voxel_start[n+1] |
+ *  origin[n] | min_x[v] | min_y[v] | min_z[v] | max_x[v] |
+ *  max_y[v] | max_z[v] | core_x[v] | core_y[v] | core_z[v]
+ *
+ *  where n is the number of objects and v is the number of
+ *  voxels. The voxels of object i are within
+ *  [voxel_start[i], voxel_start[i+1]). origin[i] is the ID
+ *  of object i before the tile is reorganized, which is
+ *  not stored in version 2
+ *
+ */
+
+#ifndef HISPEED_META_H_
+#define HISPEED_META_H_
+
+#include <stdint.h>
+#include <vector>
+#include "../spatial/himesh.h"
+
+using namespace std;
+
+namespace hispeed{
+
+// "HSMT" in little endian
+const static uint32_t META_MAGIC = 0x544d5348;
+const static uint32_t META_VERSION = 3;
+// the oldest version can be parsed
+const static uint32_t META_MIN_VERSION = 2;
+// min[3], max[3], core[3] for each voxel
+const static int META_VOXEL_COLUMNS = 9;
+
+typedef struct meta_header_{
+	uint32_t magic;
+	uint32_t version;
+	uint64_t num_objects;
+	uint64_t num_voxels;
+}meta_header;
+
+/*
+ * the data files generated by compress or data_generator
+ * have the metadata attached as a footer, followed by this
+ * trailer at the very end of the file
+ * */
+// "HSFT" in little endian
+const static uint32_t FOOTER_MAGIC = 0x54465348;
+typedef struct meta_trailer_{
+	uint64_t meta_offset;
+	uint32_t magic;
+	uint32_t version;
+}meta_trailer;
+
+/*
+ * a view on the metadata stored in a buffer
+ * */
+class tile_meta{
+public:
+	meta_header *header = NULL;
+	size_t *offsets = NULL;
+	size_t *data_sizes = NULL;
+	size_t *voxel_starts = NULL;
+	// NULL for the metadata without origins
+	size_t *origins = NULL;
+	float *columns[META_VOXEL_COLUMNS];
+
+	// parse the buffer, false if it is not a valid metadata
+	bool parse(char *data, size_t length);
+	size_t num_objects(){
+		return header->num_objects;
+	}
+	size_t num_voxels(){
+		return header->num_voxels;
+	}
+	// the number of bytes taken by the metadata
+	static size_t size(size_t num_objects, size_t num_voxels, uint32_t version = META_VERSION);
+};
+
+/*
+ * generate the metadata object by object
+ * */
+class meta_builder{
+	vector<size_t> offsets;
+	vector<size_t> data_sizes;
+	vector<size_t> voxel_starts;
+	vector<size_t> origins;
+	vector<float> columns[META_VOXEL_COLUMNS];
+public:
+	meta_builder(){
+		voxel_starts.push_back(0);
+	}
+	// the voxels can be shifted with a given vector. The origin
+	// is the position of the object in the builder by default
+	void add_object(size_t offset, size_t data_size, vector<Voxel *> &voxels,
+			const float *shift = NULL, long origin = -1);
+	// the voxels are given as min[3], max[3], core[3] each
+	void add_object(size_t offset, size_t data_size, const float *voxels, size_t num_voxels,
+			long origin = -1);
+	size_t num_objects(){
+		return offsets.size();
+	}
+	// append the objects in another builder, whose
+	// offsets are relative to base_offset
+	void append(meta_builder &builder, size_t base_offset);
+	// serialize into a newly allocated buffer
+	char *serialize(size_t &length);
+	// serialize with the trailer, to be appended to a
+	// data file at meta_offset
+	char *serialize_footer(size_t meta_offset, size_t &length);
+};
+
+}
+
+#endif /* HISPEED_META_H_ */
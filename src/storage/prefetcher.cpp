@@ -0,0 +1,147 @@
+/*
+ * prefetcher.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include <algorithm>
+#include "prefetcher.h"
+
+namespace hispeed{
+
+void *prefetch_unit(void *arg){
+	((prefetcher *)arg)->run();
+	return NULL;
+}
+
+prefetcher::prefetcher(int num_threads){
+	assert(num_threads>0);
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&job_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	threads.resize(num_threads);
+	for(int i=0;i<num_threads;i++){
+		pthread_create(&threads[i], NULL, prefetch_unit, (void *)this);
+	}
+}
+
+prefetcher::~prefetcher(){
+	pthread_mutex_lock(&lock);
+	stop = true;
+	jobs.clear();
+	pthread_cond_broadcast(&job_cond);
+	pthread_mutex_unlock(&lock);
+	for(pthread_t &t:threads){
+		void *status;
+		pthread_join(t, &status);
+	}
+	threads.clear();
+}
+
+void prefetcher::submit(vector<prefetch_job> &new_jobs){
+	if(new_jobs.size()==0){
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	jobs.insert(jobs.end(), new_jobs.begin(), new_jobs.end());
+	pthread_cond_broadcast(&job_cond);
+	pthread_mutex_unlock(&lock);
+}
+
+void prefetcher::cancel(const void *owner){
+	pthread_mutex_lock(&lock);
+	for(deque<prefetch_job>::iterator it=jobs.begin();it!=jobs.end();){
+		if(it->owner==owner){
+			it = jobs.erase(it);
+		}else{
+			it++;
+		}
+	}
+	while(inflight.find(owner)!=inflight.end()){
+		pthread_cond_wait(&done_cond, &lock);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+// read the compressed data of the objects in one shot, the
+// data of each object is handed over to its wrapper if the
+// mesh is not retrieved yet
+void prefetcher::fetch(prefetch_job &job){
+	vector<HiMesh_Wrapper *> targets;
+	for(HiMesh_Wrapper *w:job.wrappers){
+		if(w->mesh==NULL&&w->raw==NULL&&!w->loading){
+			targets.push_back(w);
+		}
+	}
+	if(targets.size()==0){
+		return;
+	}
+	size_t start = targets[0]->offset;
+	size_t end = 0;
+	for(HiMesh_Wrapper *w:targets){
+		end = std::max(end, w->offset+w->data_size);
+	}
+	char *data = new char[end-start];
+	size_t rd = 0;
+	while(rd<end-start){
+		ssize_t r = pread(job.fd, data+rd, end-start-rd, start+rd);
+		if(r<=0){
+			break;
+		}
+		rd += r;
+	}
+	size_t num_fetched = 0;
+	size_t bytes_fetched = 0;
+	for(HiMesh_Wrapper *w:targets){
+		// leave it to the synchronous read
+		if(w->offset+w->data_size>start+rd){
+			continue;
+		}
+		pthread_mutex_lock(&w->lock);
+		if(w->mesh==NULL&&w->raw==NULL&&!w->loading){
+			w->raw = new char[w->data_size];
+			memcpy(w->raw, data+w->offset-start, w->data_size);
+			num_fetched++;
+			bytes_fetched += w->data_size;
+		}
+		pthread_mutex_unlock(&w->lock);
+	}
+	delete []data;
+	pthread_mutex_lock(&lock);
+	reads++;
+	fetched += num_fetched;
+	fetched_bytes += bytes_fetched;
+	pthread_mutex_unlock(&lock);
+}
+
+void prefetcher::run(){
+	while(true){
+		pthread_mutex_lock(&lock);
+		while(jobs.empty()&&!stop){
+			pthread_cond_wait(&job_cond, &lock);
+		}
+		if(stop){
+			pthread_mutex_unlock(&lock);
+			break;
+		}
+		prefetch_job job = jobs.front();
+		jobs.pop_front();
+		inflight[job.owner]++;
+		pthread_mutex_unlock(&lock);
+
+		fetch(job);
+
+		pthread_mutex_lock(&lock);
+		if(--inflight[job.owner]==0){
+			inflight.erase(job.owner);
+			pthread_cond_broadcast(&done_cond);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+void prefetcher::report(){
+	log("prefetcher: %ld objects %ld MB fetched with %ld reads", fetched, fetched_bytes>>20, reads);
+}
+
+}
@@ -0,0 +1,64 @@
+/*
+ * prefetcher.h
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  a pool of I/O threads fetching the compressed data of
+ *  the objects which are going to be decoded, such that
+ *  the decoding is overlapped with the disk reads
+ *
+ */
+
+#ifndef HISPEED_PREFETCHER_H_
+#define HISPEED_PREFETCHER_H_
+
+#include <pthread.h>
+#include <deque>
+#include <map>
+#include <vector>
+#include "../util/util.h"
+#include "../spatial/himesh.h"
+
+using namespace std;
+
+namespace hispeed{
+
+typedef struct prefetch_job_{
+	// the tile which submitted this job
+	const void *owner;
+	int fd;
+	// the objects sorted by their offsets, which are
+	// close to each other and read together
+	vector<HiMesh_Wrapper *> wrappers;
+}prefetch_job;
+
+class prefetcher{
+	pthread_mutex_t lock;
+	// signaled when new jobs come or stopping
+	pthread_cond_t job_cond;
+	// signaled when jobs of some owner are done
+	pthread_cond_t done_cond;
+	deque<prefetch_job> jobs;
+	// number of jobs being processed for each owner
+	map<const void *, int> inflight;
+	vector<pthread_t> threads;
+	bool stop = false;
+	void fetch(prefetch_job &job);
+public:
+	size_t fetched = 0;
+	size_t fetched_bytes = 0;
+	size_t reads = 0;
+	prefetcher(int num_threads);
+	~prefetcher();
+	// the jobs are processed in the order they are submitted
+	void submit(vector<prefetch_job> &new_jobs);
+	// drop the pending jobs of owner and wait for the
+	// ones being processed
+	void cancel(const void *owner);
+	void run();
+	void report();
+};
+
+}
+
+#endif /* HISPEED_PREFETCHER_H_ */
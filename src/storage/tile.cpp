@@ -13,6 +13,7 @@
  */
 
 
+#include <fcntl.h>
 #include "tile.h"
 
 
@@ -21,13 +22,14 @@ namespace hispeed{
 // load meta data from file
 // and construct the hierarchy structure
 // tile->mesh->voxels->triangle/edges
-Tile::Tile(std::string path, size_t capacity){
+Tile::Tile(std::string path, size_t capacity, bool use_mmap){
 	struct timeval start = get_cur_time();
 	this->capacity = capacity;
 	if(!hispeed::file_exist(path.c_str())){
 		log("%s does not exist", path.c_str());
 		exit(-1);
 	}
+	dt_path = path;
 	dt_fs = fopen(path.c_str(), "r");
 	if(!dt_fs){
 		log("%s can not be opened", path.c_str());
@@ -35,19 +37,52 @@ Tile::Tile(std::string path, size_t capacity){
 	}
 	string meta_path = path;
 	boost::replace_all(meta_path, ".dt", ".mt");
-	if(!hispeed::file_exist(meta_path.c_str())){
-		parse_raw();
-		persist(meta_path);
-	}else{
-		load(meta_path);
+	// the metadata attached to the data file is preferred, then
+	// the one cached in the meta file if it is not stale
+	if(!load_footer()){
+		if(!hispeed::file_exist(meta_path.c_str())||
+		   hispeed::file_mtime(meta_path.c_str())<hispeed::file_mtime(path.c_str())||
+		   !load(meta_path)){
+			parse_raw();
+			persist(meta_path);
+		}
+	}
+	if(use_mmap&&!map_data()){
+		log("failed to map %s, fall back to file reading", path.c_str());
 	}
 	pthread_mutex_init(&read_lock, NULL);
 	logt("loaded %ld polyhedra in tile %s", start, objects.size(), path.c_str());
 }
 
 Tile::~Tile(){
-	for(HiMesh_Wrapper *h:objects){
-		delete h;
+	if(fetcher!=NULL){
+		fetcher->cancel(this);
+	}
+	if(cache!=NULL){
+		cache->erase(this);
+	}
+	if(wrapper_pool!=NULL){
+		delete []wrapper_pool;
+		wrapper_pool = NULL;
+	}else{
+		for(HiMesh_Wrapper *h:objects){
+			delete h;
+		}
+	}
+	objects.clear();
+	if(index!=NULL){
+		delete index;
+		index = NULL;
+	}
+	if(voxel_pool!=NULL){
+		delete []voxel_pool;
+		voxel_pool = NULL;
+	}
+	// the meshes refer to the mapped data
+	// should be released before unmapping
+	if(dt_map!=NULL){
+		munmap(dt_map, dt_size);
+		dt_map = NULL;
 	}
 	// close the data file pointer
 	if(dt_fs!=NULL){
@@ -59,11 +94,18 @@ Tile::~Tile(){
 void Tile::disable_innerpart(){
 	for(HiMesh_Wrapper *w:this->objects){
 		if(w->voxels.size()>1){
-			for(Voxel *v:w->voxels){
-				delete v;
+			// take the index of the first voxel replaced
+			int vid = w->voxels[0]->id;
+			// the pooled voxels are released with the tile
+			if(w->own_voxels){
+				for(Voxel *v:w->voxels){
+					delete v;
+				}
 			}
 			w->voxels.clear();
+			w->own_voxels = true;
 			Voxel *v = new Voxel();
+			v->id = vid;
 			v->box = w->box.box;
 			for(int i=0;i<3;i++){
 				v->core[i] = (v->box.max[i]-v->box.min[i])/2+v->box.min[i];
@@ -76,50 +118,183 @@ void Tile::disable_innerpart(){
 
 // persist the meta data for current tile as a cache
 bool Tile::persist(string path){
-	FILE *mt_fs = fopen(path.c_str(), "wb+");
-	assert(mt_fs);
+	meta_builder builder;
 	for(HiMesh_Wrapper *w:objects){
-		fwrite((void *)&w->offset, sizeof(size_t), 1, mt_fs);
-		fwrite((void *)&w->data_size, sizeof(size_t), 1, mt_fs);
-		size_t dsize = w->voxels.size();
-		fwrite((void *)&dsize, sizeof(size_t), 1, mt_fs);
-		for(Voxel *v:w->voxels){
-			fwrite((void *)v->box.min, sizeof(float), 3, mt_fs);
-			fwrite((void *)v->box.max, sizeof(float), 3, mt_fs);
-			fwrite((void *)v->core, sizeof(float), 3, mt_fs);
-		}
+		builder.add_object(w->offset, w->data_size, w->voxels, NULL, w->origin);
 	}
+	size_t length = 0;
+	char *data = builder.serialize(length);
+	FILE *mt_fs = fopen(path.c_str(), "wb+");
+	assert(mt_fs);
+	size_t wt = fwrite(data, sizeof(char), length, mt_fs);
 	fclose(mt_fs);
-	return true;
+	delete []data;
+	return wt==length;
 }
 
 // load from the cached data
 bool Tile::load(string path){
 	FILE *mt_fs = fopen(path.c_str(), "r");
 	assert(mt_fs);
-	size_t dsize = 0;
-	size_t index = 0;
-	while(index<capacity&&fread((void *)&dsize, sizeof(size_t), 1, mt_fs)>0){
-		HiMesh_Wrapper *w = new HiMesh_Wrapper();
-		w->offset = dsize;
-		fread((void *)&w->data_size, sizeof(size_t), 1, mt_fs);
-		w->id = index++;
+	// the versioned metadata
+	uint32_t magic = 0;
+	if(fread((void *)&magic, sizeof(uint32_t), 1, mt_fs)==1&&magic==META_MAGIC){
+		fclose(mt_fs);
+		return load_meta(path);
+	}
+	// the legacy metadata, each object is stored as
+	// offset, size, number of voxels, voxel boxes
+	fseek(mt_fs, 0, SEEK_SET);
+	meta_builder builder;
+	vector<float> voxels;
+	size_t offset = 0;
+	size_t data_size = 0;
+	size_t num_voxels = 0;
+	while(builder.num_objects()<capacity&&fread((void *)&offset, sizeof(size_t), 1, mt_fs)>0){
+		fread((void *)&data_size, sizeof(size_t), 1, mt_fs);
+		fread((void *)&num_voxels, sizeof(size_t), 1, mt_fs);
+		voxels.resize(9*num_voxels);
+		fread((void *)voxels.data(), sizeof(float), 9*num_voxels, mt_fs);
+		builder.add_object(offset, data_size, voxels.data(), num_voxels);
+	}
+	fclose(mt_fs);
+	build_objects(builder);
+	return true;
+}
+
+// map the versioned metadata file and build the objects
+bool Tile::load_meta(string path){
+	long fsize = hispeed::file_size(path.c_str());
+	if(fsize<=0){
+		return false;
+	}
+	int fd = open(path.c_str(), O_RDONLY);
+	if(fd<0){
+		return false;
+	}
+	void *addr = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr==MAP_FAILED){
+		return false;
+	}
+	madvise(addr, fsize, MADV_SEQUENTIAL);
+	tile_meta meta;
+	bool valid = meta.parse((char *)addr, fsize);
+	if(valid){
+		build_objects(meta);
+	}else{
+		log("%s is not a valid metadata file", path.c_str());
+	}
+	munmap(addr, fsize);
+	return valid;
+}
+
+// build the objects and their voxels with the columns. The
+// wrappers and voxels are allocated in bulk and released
+// together with the tile
+void Tile::build_objects(tile_meta &meta){
+	assert(wrapper_pool==NULL&&objects.size()==0);
+	size_t num_objects = std::min(capacity, meta.num_objects());
+	wrapper_pool = new HiMesh_Wrapper[num_objects];
+	voxel_count = meta.voxel_starts[num_objects];
+	voxel_pool = new Voxel[voxel_count];
+	objects.reserve(num_objects);
+	for(size_t i=0;i<num_objects;i++){
+		HiMesh_Wrapper *w = wrapper_pool+i;
+		w->own_voxels = false;
+		w->offset = meta.offsets[i];
+		w->data_size = meta.data_sizes[i];
+		w->id = i;
+		w->origin = meta.origins==NULL?i:meta.origins[i];
 		w->box.id = w->id;
-		// read the voxels into the wrapper
-		fread((void *)&dsize, sizeof(size_t), 1, mt_fs);
-		for(int i=0;i<dsize;i++){
-			Voxel *v = new Voxel();
-			fread((void *)v->box.min, sizeof(float), 3, mt_fs);
-			fread((void *)v->box.max, sizeof(float), 3, mt_fs);
-			fread((void *)v->core, sizeof(float), 3, mt_fs);
+		w->voxels.reserve(meta.voxel_starts[i+1]-meta.voxel_starts[i]);
+		for(size_t j=meta.voxel_starts[i];j<meta.voxel_starts[i+1];j++){
+			Voxel *v = voxel_pool+j;
+			v->id = j;
+			for(int k=0;k<3;k++){
+				v->box.min[k] = meta.columns[k][j];
+				v->box.max[k] = meta.columns[k+3][j];
+				v->core[k] = meta.columns[k+6][j];
+			}
 			w->voxels.push_back(v);
 			w->box.box.update(v->box);
 		}
 		objects.push_back(w);
 		box.update(w->box.box);
 	}
-	fclose(mt_fs);
-	return true;
+}
+
+void Tile::build_objects(meta_builder &builder){
+	size_t length = 0;
+	char *data = builder.serialize(length);
+	tile_meta meta;
+	bool valid = meta.parse(data, length);
+	assert(valid);
+	build_objects(meta);
+	delete []data;
+}
+
+// read the trailer at the end of the data file
+bool Tile::read_trailer(meta_trailer &trailer){
+	assert(dt_fs);
+	fseek(dt_fs, 0, SEEK_END);
+	long fsize = ftell(dt_fs);
+	if(fsize<(long)sizeof(meta_trailer)){
+		return false;
+	}
+	fseek(dt_fs, fsize-sizeof(meta_trailer), SEEK_SET);
+	if(fread((void *)&trailer, sizeof(meta_trailer), 1, dt_fs)!=1){
+		return false;
+	}
+	return trailer.magic==FOOTER_MAGIC&&
+		   trailer.meta_offset+sizeof(meta_trailer)<=(size_t)fsize;
+}
+
+// load the metadata from the footer of the data file. The tail
+// of the file is read in one shot, which covers the whole footer
+// in most cases
+bool Tile::load_footer(){
+	assert(dt_fs);
+	const long max_tail = 1<<20;
+	fseek(dt_fs, 0, SEEK_END);
+	long fsize = ftell(dt_fs);
+	if(fsize<(long)sizeof(meta_trailer)){
+		return false;
+	}
+	long tail = std::min(fsize, max_tail);
+	char *buffer = new char[tail];
+	fseek(dt_fs, fsize-tail, SEEK_SET);
+	if(fread(buffer, sizeof(char), tail, dt_fs)!=(size_t)tail){
+		delete []buffer;
+		return false;
+	}
+	meta_trailer trailer;
+	memcpy((char *)&trailer, buffer+tail-sizeof(meta_trailer), sizeof(meta_trailer));
+	if(trailer.magic!=FOOTER_MAGIC||
+	   trailer.meta_offset+sizeof(meta_trailer)>(size_t)fsize){
+		delete []buffer;
+		return false;
+	}
+	size_t meta_length = fsize-sizeof(meta_trailer)-trailer.meta_offset;
+	if(meta_length+sizeof(meta_trailer)<=(size_t)tail){
+		// move to the head of the buffer for alignment
+		memmove(buffer, buffer+tail-sizeof(meta_trailer)-meta_length, meta_length);
+	}else{
+		delete []buffer;
+		buffer = new char[meta_length];
+		fseek(dt_fs, trailer.meta_offset, SEEK_SET);
+		if(fread(buffer, sizeof(char), meta_length, dt_fs)!=meta_length){
+			delete []buffer;
+			return false;
+		}
+	}
+	tile_meta meta;
+	bool valid = meta.parse(buffer, meta_length);
+	if(valid){
+		build_objects(meta);
+	}
+	delete []buffer;
+	return valid;
 }
 
 // parse the metadata
@@ -127,41 +302,247 @@ bool Tile::parse_raw(){
 	assert(dt_fs);
 	size_t dsize = 0;
 	long offset = 0;
-	size_t index = 0;
+	// do not parse the footer as objects
+	long data_end = LONG_MAX;
+	meta_trailer trailer;
+	if(read_trailer(trailer)){
+		data_end = trailer.meta_offset;
+	}
 	fseek(dt_fs, 0, SEEK_SET);
-	while(index<capacity&&fread((void *)&dsize, sizeof(size_t), 1, dt_fs)>0){
+	meta_builder builder;
+	vector<float> voxels;
+	while(builder.num_objects()<capacity&&offset<data_end&&fread((void *)&dsize, sizeof(size_t), 1, dt_fs)>0){
 		fseek(dt_fs, dsize, SEEK_CUR);
-		HiMesh_Wrapper *w = new HiMesh_Wrapper();
 		offset += sizeof(size_t);
-		w->offset = offset;
-		w->data_size = dsize;
-		w->id = index++;
-		w->box.id = w->id;
-		// read the voxels into the wrapper
+		size_t data_size = dsize;
+		// read the voxels of the object
 		fread((void *)&dsize, sizeof(size_t), 1, dt_fs);
-		for(int i=0;i<dsize;i++){
-			Voxel *v = new Voxel();
-			fread((void *)v->box.min, sizeof(float), 3, dt_fs);
-			fread((void *)v->box.max, sizeof(float), 3, dt_fs);
-			fread((void *)v->core, sizeof(float), 3, dt_fs);
-			w->voxels.push_back(v);
-			w->box.box.update(v->box);
-		}
-		objects.push_back(w);
-		box.update(w->box.box);
+		voxels.resize(9*dsize);
+		fread((void *)voxels.data(), sizeof(float), 9*dsize, dt_fs);
+		builder.add_object(offset, data_size, voxels.data(), dsize);
 		// update the offset for next
-		offset += w->data_size+sizeof(size_t)+9*sizeof(float)*dsize;
+		offset += data_size+sizeof(size_t)+9*sizeof(float)*dsize;
+	}
+	build_objects(builder);
+	return true;
+}
+
+// reorganize the objects into a new data file in the order of
+// the Hilbert curve of their centroids. The objects are packed
+// into blocks of block_size bytes, an object is not split by
+// the block boundary unless it is larger than a block. Then the
+// objects close to each other are stored close in the file. The
+// IDs in this tile are kept as the origins in the metadata. As
+// the blocks are padded, the new file is parsed with its footer
+bool Tile::rewrite(string path, size_t block_size){
+	struct timeval start = get_cur_time();
+	// 16 bits for each dimension
+	const int bits = 16;
+	float scale[3];
+	for(int i=0;i<3;i++){
+		float extent = box.max[i]-box.min[i];
+		scale[i] = extent>0?((1<<bits)-1)/extent:0;
+	}
+	vector<pair<uint64_t, HiMesh_Wrapper *>> order;
+	order.reserve(objects.size());
+	for(HiMesh_Wrapper *w:objects){
+		uint32_t c[3];
+		for(int i=0;i<3;i++){
+			float mid = (w->box.box.min[i]+w->box.box.max[i])/2;
+			c[i] = (uint32_t)((mid-box.min[i])*scale[i]);
+		}
+		order.push_back(pair<uint64_t, HiMesh_Wrapper *>(hilbert_key(c[0], c[1], c[2], bits), w));
+	}
+	std::stable_sort(order.begin(), order.end(),
+			[](const pair<uint64_t, HiMesh_Wrapper *> &a, const pair<uint64_t, HiMesh_Wrapper *> &b){
+		return a.first<b.first;
+	});
+
+	FILE *fs = fopen(path.c_str(), "wb");
+	if(!fs){
+		log("%s can not be opened", path.c_str());
+		return false;
+	}
+	meta_builder builder;
+	char *padding = NULL;
+	if(block_size>0){
+		padding = new char[block_size];
+		memset(padding, 0, block_size);
+	}
+	size_t offset = 0;
+	size_t num_blocks = block_size>0?1:0;
+	bool success = true;
+	for(pair<uint64_t, HiMesh_Wrapper *> &o:order){
+		HiMesh_Wrapper *w = o.second;
+		size_t num_voxels = w->voxels.size();
+		size_t record = 2*sizeof(size_t)+w->data_size+9*sizeof(float)*num_voxels;
+		size_t used = block_size>0?offset%block_size:0;
+		// move to the next block
+		if(used>0&&used+record>block_size&&record<=block_size){
+			success &= fwrite(padding, sizeof(char), block_size-used, fs)==block_size-used;
+			offset += block_size-used;
+		}
+		if(block_size>0){
+			num_blocks = (offset+record+block_size-1)/block_size;
+		}
+		char *data = NULL;
+		if(dt_map!=NULL){
+			data = dt_map+w->offset;
+		}else{
+			data = new char[w->data_size];
+			size_t rd = 0;
+			while(rd<w->data_size){
+				ssize_t r = pread(fileno(dt_fs), data+rd, w->data_size-rd, w->offset+rd);
+				if(r<=0){
+					break;
+				}
+				rd += r;
+			}
+			success &= rd==w->data_size;
+		}
+		success &= fwrite((char *)&w->data_size, sizeof(size_t), 1, fs)==1;
+		success &= fwrite(data, sizeof(char), w->data_size, fs)==w->data_size;
+		success &= fwrite((char *)&num_voxels, sizeof(size_t), 1, fs)==1;
+		for(Voxel *v:w->voxels){
+			success &= fwrite((char *)v->box.min, sizeof(float), 3, fs)==3;
+			success &= fwrite((char *)v->box.max, sizeof(float), 3, fs)==3;
+			success &= fwrite((char *)v->core, sizeof(float), 3, fs)==3;
+		}
+		if(dt_map==NULL){
+			delete []data;
+		}
+		builder.add_object(offset+sizeof(size_t), w->data_size, w->voxels, NULL, w->origin);
+		offset += record;
+	}
+	size_t length = 0;
+	char *footer = builder.serialize_footer(offset, length);
+	success &= fwrite(footer, sizeof(char), length, fs)==length;
+	delete []footer;
+	if(padding!=NULL){
+		delete []padding;
 	}
+	fclose(fs);
+	if(!success){
+		log("failed to write %s", path.c_str());
+		return false;
+	}
+	logt("reorganized %ld polyhedra into %ld blocks in %s", start, order.size(), num_blocks, path.c_str());
 	return true;
 }
 
+// map the data file into memory
+bool Tile::map_data(){
+	assert(dt_fs);
+	long fsize = 0;
+	fseek(dt_fs, 0, SEEK_END);
+	fsize = ftell(dt_fs);
+	if(fsize<=0){
+		return false;
+	}
+	void *addr = mmap(NULL, fsize, PROT_READ, MAP_PRIVATE, fileno(dt_fs), 0);
+	if(addr==MAP_FAILED){
+		return false;
+	}
+	dt_map = (char *)addr;
+	dt_size = fsize;
+	// the objects are accessed by the candidate list, the
+	// read ahead of the kernel only brings in useless pages
+	madvise(dt_map, dt_size, MADV_RANDOM);
+	return true;
+}
+
+// the objects are going to be retrieved. For the mapped tile,
+// ask the kernel to load their pages in the background, the
+// ranges are sorted and merged to save system calls. Otherwise
+// the prefetcher reads them in the order of their offsets
+void Tile::prefetch(vector<int> &ids){
+	if(ids.size()==0||(dt_map==NULL&&fetcher==NULL)){
+		return;
+	}
+	vector<HiMesh_Wrapper *> targets;
+	for(int id:ids){
+		assert(id>=0&&id<objects.size());
+		HiMesh_Wrapper *w = objects[id];
+		if(w->mesh!=NULL||w->raw!=NULL||w->loading){
+			continue;
+		}
+		targets.push_back(w);
+	}
+	if(targets.size()==0){
+		return;
+	}
+	std::sort(targets.begin(), targets.end(), [](HiMesh_Wrapper *a, HiMesh_Wrapper *b){
+		return a->offset<b->offset;
+	});
+	targets.erase(std::unique(targets.begin(), targets.end()), targets.end());
+	if(dt_map==NULL){
+		// the objects close to each other are read together,
+		// which is common for the clustered tiles
+		const size_t max_gap = 64<<10;
+		const size_t max_span = 4<<20;
+		vector<prefetch_job> jobs;
+		size_t start = 0;
+		size_t end = 0;
+		for(HiMesh_Wrapper *w:targets){
+			if(jobs.size()==0||w->offset>end+max_gap||
+			   w->offset+w->data_size>start+max_span){
+				prefetch_job job;
+				job.owner = this;
+				job.fd = fileno(dt_fs);
+				jobs.push_back(job);
+				start = w->offset;
+				end = w->offset;
+			}
+			jobs.back().wrappers.push_back(w);
+			end = std::max(end, w->offset+w->data_size);
+		}
+		fetcher->submit(jobs);
+		return;
+	}
+	const size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t start = targets[0]->offset/page_size*page_size;
+	size_t end = targets[0]->offset+targets[0]->data_size;
+	for(HiMesh_Wrapper *w:targets){
+		if(w->offset>end){
+			madvise(dt_map+start, end-start, MADV_WILLNEED);
+			start = w->offset/page_size*page_size;
+		}
+		end = std::max(end, w->offset+w->data_size);
+	}
+	madvise(dt_map+start, end-start, MADV_WILLNEED);
+}
+
 // retrieve the mesh of the voxel group with ID id on demand
 void Tile::retrieve_mesh(int id){
 	assert(id>=0&&id<objects.size());
 	HiMesh_Wrapper *wrapper = objects[id];
+	// decode from the mapped data directly, no need to
+	// serialize the reads or copy the data
+	if(dt_map!=NULL){
+		pthread_mutex_lock(&wrapper->lock);
+		if(wrapper->mesh==NULL){
+			assert(wrapper->offset+wrapper->data_size<=dt_size);
+			timeval cur = hispeed::get_cur_time();
+			wrapper->mesh = new HiMesh(dt_map+wrapper->offset, wrapper->data_size, false);
+			wrapper->mesh->borrow_data();
+			newmesh_time += hispeed::get_time_elapsed(cur, true);
+		}
+		pthread_mutex_unlock(&wrapper->lock);
+		return;
+	}
 	char *mesh_data = NULL;
+	// take the data fetched by the prefetcher
+	pthread_mutex_lock(&wrapper->lock);
+	if(wrapper->mesh==NULL&&wrapper->raw!=NULL){
+		mesh_data = wrapper->raw;
+		wrapper->raw = NULL;
+	}else if(wrapper->mesh==NULL){
+		// the prefetcher skips it while read here
+		wrapper->loading = true;
+	}
+	pthread_mutex_unlock(&wrapper->lock);
 	pthread_mutex_lock(&read_lock);
-	if(wrapper->mesh==NULL){
+	if(wrapper->mesh==NULL&&mesh_data==NULL){
 		timeval cur = hispeed::get_cur_time();
 		mesh_data = new char[wrapper->data_size];
 		malloc_time += hispeed::get_time_elapsed(cur, true);
@@ -177,7 +558,16 @@ void Tile::retrieve_mesh(int id){
 		timeval cur = hispeed::get_cur_time();
 		wrapper->mesh = new HiMesh(mesh_data, wrapper->data_size, false);
 		newmesh_time += hispeed::get_time_elapsed(cur, true);
+	}else if(mesh_data!=NULL){
+		// retrieved by another thread
+		delete []mesh_data;
 	}
+	// fetched by the prefetcher while read here
+	if(wrapper->raw!=NULL){
+		delete []wrapper->raw;
+		wrapper->raw = NULL;
+	}
+	wrapper->loading = false;
 	pthread_mutex_unlock(&wrapper->lock);
 }
 
@@ -190,6 +580,112 @@ OctreeNode *Tile::build_octree(size_t leaf_size){
 }
 
 
+OctreeNode *Tile::get_index(){
+	pthread_mutex_lock(&index_lock);
+	if(index==NULL){
+		index = build_octree(400);
+	}
+	pthread_mutex_unlock(&index_lock);
+	return index;
+}
+
+bool Tile::query(aab &query_box, int lod, enum data_type seg_tri, query_result &result){
+	weighted_aab wbox;
+	wbox.box = query_box;
+	vector<int> candidates;
+	get_index()->query_intersect(&wbox, candidates);
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+	// refine with the voxels
+	vector<int> ids;
+	for(int id:candidates){
+		for(Voxel *v:objects[id]->voxels){
+			if(v->box.intersect(query_box)){
+				ids.push_back(id);
+				break;
+			}
+		}
+	}
+	return fetch(ids, lod, seg_tri, result);
+}
+
+bool Tile::query(float *point, float distance, int lod, enum data_type seg_tri, query_result &result){
+	aab p(point[0], point[1], point[2], point[0], point[1], point[2]);
+	weighted_aab wbox;
+	wbox.box = aab(point[0]-distance, point[1]-distance, point[2]-distance,
+				   point[0]+distance, point[1]+distance, point[2]+distance);
+	vector<int> candidates;
+	get_index()->query_intersect(&wbox, candidates);
+	std::sort(candidates.begin(), candidates.end());
+	candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+	// the distances are squared
+	const float dd = distance*distance;
+	vector<int> ids;
+	for(int id:candidates){
+		if(objects[id]->box.box.distance(p).closest>dd){
+			continue;
+		}
+		for(Voxel *v:objects[id]->voxels){
+			if(v->box.distance(p).closest<=dd){
+				ids.push_back(id);
+				break;
+			}
+		}
+	}
+	return fetch(ids, lod, seg_tri, result);
+}
+
+// the objects whose data at lod is not available are listed in
+// the failed ones of result: they are decoded beyond lod already,
+// or filled with the other data type at lod
+bool Tile::fetch(vector<int> &ids, int lod, enum data_type seg_tri, query_result &result){
+	result.clear();
+	result.datum_size = seg_tri==DT_Segment?6:9;
+	prefetch(ids);
+	vector<voxel_buffer *> buffers;
+	// the ones filled for this fetch only, released after copying
+	vector<bool> filled;
+	size_t total = 0;
+	result.offsets.push_back(0);
+	for(int id:ids){
+		const bool was_filled = cache!=NULL||objects[id]->is_filled(lod);
+		// without a cache, the meshes decoded for this fetch
+		// are released once filled, as in the joins
+		const bool decoded = cache==NULL&&objects[id]->mesh==NULL;
+		fill_to(id, lod, seg_tri, decoded);
+		voxel_buffer *buffer = objects[id]->get_buffer(lod);
+		if(buffer==NULL||buffer->datum_size!=result.datum_size){
+			if(cache!=NULL){
+				unpin(id, lod);
+			}else if(!was_filled){
+				objects[id]->reset(lod);
+			}
+			result.failed.push_back(id);
+			continue;
+		}
+		result.ids.push_back(id);
+		buffers.push_back(buffer);
+		filled.push_back(!was_filled);
+		total += buffer->size/buffer->datum_size;
+		result.offsets.push_back(total);
+	}
+	result.data = new float[total*result.datum_size];
+	for(size_t i=0;i<buffers.size();i++){
+		memcpy(result.data+result.offsets[i]*result.datum_size, buffers[i]->data,
+				buffers[i]->size*sizeof(float));
+		if(cache!=NULL){
+			unpin(result.ids[i], lod);
+		}else if(filled[i]){
+			objects[result.ids[i]]->reset(lod);
+		}
+	}
+	if(!result.failed.empty()){
+		log("%ld objects are not available at lod %d", result.failed.size(), lod);
+		return false;
+	}
+	return true;
+}
+
 void Tile::decode_to(int id, int lod){
 	assert(id>=0&&id<objects.size());
 	timeval cur = hispeed::get_cur_time();
@@ -201,7 +697,106 @@ void Tile::decode_to(int id, int lod){
 	decode_time += hispeed::get_time_elapsed(start,true);
 }
 
+void Tile::fill_shared(int id, int lod, enum data_type seg_tri, bool release_mesh){
+	HiMesh_Wrapper *wrapper = objects[id];
+	bool share = sharing!=NULL&&dt_path.size()>0;
+	job_key key(dt_path, id, lod, (int)seg_tri);
+	if(share){
+		voxel_buffer *buffer = sharing->acquire(key);
+		if(buffer!=NULL){
+			wrapper->attach(lod, buffer);
+			if(release_mesh){
+				wrapper->release_mesh();
+			}
+			return;
+		}
+	}
+	decode_to(id, lod);
+	wrapper->fill_voxels(seg_tri, release_mesh);
+	if(share){
+		voxel_buffer *buffer = wrapper->get_buffer(lod);
+		if(buffer!=NULL){
+			sharing->publish(key, buffer);
+		}else{
+			sharing->abandon(key);
+		}
+	}
+}
+
+void Tile::fill_to(int id, int lod, enum data_type seg_tri, bool release_mesh){
+	assert(id>=0&&id<objects.size());
+	HiMesh_Wrapper *wrapper = objects[id];
+	if(cache==NULL){
+		// both sides of a self join may fill the same object
+		pthread_mutex_lock(&wrapper->fill_lock);
+		if(!wrapper->is_filled(lod)){
+			fill_shared(id, lod, seg_tri, release_mesh);
+		}
+		pthread_mutex_unlock(&wrapper->fill_lock);
+		return;
+	}
+	// filled already
+	if(cache->pin(this, wrapper, lod)){
+		return;
+	}
+	// keep the mesh from being evicted while decoding
+	cache->pin(this, wrapper, CACHE_MESH_LOD);
+	fill_shared(id, lod, seg_tri, release_mesh);
+
+	// the shared buffers are counted by each tile using them
+	voxel_buffer *buffer = wrapper->get_buffer(lod);
+	cache->resize(this, id, lod, buffer==NULL?0:buffer->size*sizeof(float));
+	cache->ready(this, id, lod);
+	if(wrapper->mesh!=NULL){
+		size_t mesh_size = wrapper->mesh->memory_size();
+		// the compressed data is copied if not mapped
+		if(dt_map==NULL){
+			mesh_size += wrapper->data_size;
+		}
+		cache->resize(this, id, CACHE_MESH_LOD, mesh_size);
+		cache->unpin(this, id, CACHE_MESH_LOD);
+	}else{
+		// released after filling the top LOD
+		cache->drop(this, id, CACHE_MESH_LOD);
+	}
+}
+
+void Tile::unpin(int id, int lod){
+	if(cache!=NULL){
+		cache->unpin(this, id, lod);
+	}
+}
+
+bool Tile::drop(int id, int lod){
+	assert(id>=0&&id<objects.size());
+	if(cache!=NULL){
+		return cache->drop(this, id, lod);
+	}
+	objects[id]->reset(lod);
+	return true;
+}
+
+// release the decoded mesh, the fetched data and the filled voxels
+// of object id, which are retrieved from the disk again if needed
+void Tile::release(int id){
+	assert(id>=0&&id<objects.size());
+	HiMesh_Wrapper *wrapper = objects[id];
+	// the data still pinned by others is released by them
+	if(cache!=NULL&&!cache->erase(this, id)){
+		return;
+	}
+	wrapper->reset();
+	wrapper->release_mesh();
+	pthread_mutex_lock(&wrapper->lock);
+	if(wrapper->raw!=NULL){
+		delete []wrapper->raw;
+		wrapper->raw = NULL;
+	}
+	pthread_mutex_unlock(&wrapper->lock);
+}
+
 void Tile::add_raw(char *data){
+	assert(wrapper_pool==NULL);
 	size_t offset = 0;
 	size_t size_tmp = 0;
 	memcpy((char *)&size_tmp, data+offset, sizeof(size_t));
@@ -213,6 +808,7 @@ void Tile::add_raw(char *data){
 	HiMesh_Wrapper *hw = new HiMesh_Wrapper();
 	for(size_t i=0;i<size_tmp;i++){
 		Voxel *v = new Voxel();
+		v->id = voxel_count++;
 		memcpy((char *)v->box.min, data+offset, 3*sizeof(float));
 		offset += 3*sizeof(float);
 		memcpy((char *)v->box.max, data+offset, 3*sizeof(float));
@@ -11,29 +11,101 @@
 
 #include "../spatial/himesh.h"
 #include "../index/index.h"
+#include "cache.h"
+#include "job_sharing.h"
+#include "meta.h"
+#include "prefetcher.h"
 #include <pthread.h>
+#include <sys/mman.h>
 
 using namespace std;
 
 namespace hispeed{
 
+// the objects found by a query on a tile, with their segments or
+// triangles at the queried LOD in one contiguous buffer. The data
+// of the i-th object is in [offsets[i], offsets[i+1]) of data, in
+// units of datum_size floats
+class query_result{
+public:
+	vector<int> ids;
+	// the objects found but not available at the queried LOD
+	vector<int> failed;
+	vector<size_t> offsets;
+	int datum_size = 0;
+	float *data = NULL;
+	~query_result(){
+		clear();
+	}
+	size_t num_objects(){
+		return ids.size();
+	}
+	// number of segments or triangles
+	size_t num_data(){
+		return offsets.empty()?0:offsets.back();
+	}
+	void clear(){
+		if(data!=NULL){
+			delete []data;
+			data = NULL;
+		}
+		ids.clear();
+		failed.clear();
+		offsets.clear();
+		datum_size = 0;
+	}
+};
+
 class Tile{
 	pthread_mutex_t read_lock;
 	size_t capacity = LONG_MAX;
 	aab box;
 	std::vector<HiMesh_Wrapper *> objects;
+	// the wrappers and voxels loaded from the metadata
+	HiMesh_Wrapper *wrapper_pool = NULL;
+	Voxel *voxel_pool = NULL;
+	// the voxels are indexed in [0, voxel_count)
+	size_t voxel_count = 0;
 	FILE *dt_fs = NULL;
+	std::string dt_path;
+	// the data file mapped into memory, the meshes
+	// are decoded in place without being copied
+	char *dt_map = NULL;
+	size_t dt_size = 0;
+	bool map_data();
+	// cache for the decoded meshes and voxel data, shared by tiles
+	mesh_cache *cache = NULL;
+	// fetch the compressed data in the background
+	prefetcher *fetcher = NULL;
+	// share the filled voxels with other tiles of the same file
+	job_sharing *sharing = NULL;
+	int tag = -1;
+	// the index of the objects for the queries, built on demand
+	OctreeNode *index = NULL;
+	pthread_mutex_t index_lock = PTHREAD_MUTEX_INITIALIZER;
 	bool load(string path);
+	bool load_meta(string path);
+	bool read_trailer(meta_trailer &trailer);
+	bool load_footer();
+	void build_objects(tile_meta &meta);
+	void build_objects(meta_builder &builder);
 	bool persist(string path);
 	bool parse_raw();
 	// retrieve the data of the mesh with ID id on demand
 	void retrieve_mesh(int id);
+	// decode and fill, or take the voxels filled by others
+	void fill_shared(int id, int lod, enum data_type seg_tri, bool release_mesh);
+	OctreeNode *get_index();
+	// decode the objects in ids to lod and copy their data into
+	// result, return false if any of them is not available. The
+	// data decoded for it is released after copying unless cached
+	bool fetch(vector<int> &ids, int lod, enum data_type seg_tri, query_result &result);
 
 public:
 	// for building tile instead of load from file
 	Tile(){};
 	void add_raw(char *data);
-	Tile(std::string path, size_t capacity=LONG_MAX);
+	Tile(std::string path, size_t capacity=LONG_MAX, bool use_mmap=false);
 	~Tile();
 	void disable_innerpart();
 
@@ -54,10 +126,47 @@ public:
 	}
 
 	void decode_to(int id, int lod);
+	// decode object id to lod and fill its voxels, the data
+	// is pinned in the cache until unpin is called
+	void fill_to(int id, int lod, enum data_type seg_tri, bool release_mesh);
+	void unpin(int id, int lod);
+	// unpin object id at lod and drop its voxels if no one
+	// else pins them, return true if dropped
+	bool drop(int id, int lod);
+	// release the decoded data of an object
+	void release(int id);
+	void set_cache(mesh_cache *c){
+		cache = c;
+	}
+	void set_prefetcher(prefetcher *p){
+		fetcher = p;
+	}
+	void set_sharing(job_sharing *js){
+		sharing = js;
+	}
+	// identify the tile in the join results
+	void set_tag(int t){
+		tag = t;
+	}
+	int get_tag(){
+		return tag;
+	}
+	// write the objects into a new data file clustered in blocks
+	bool rewrite(string path, size_t block_size);
+	// the objects will be retrieved soon, hint the kernel for the
+	// mapped tile or fetch them with the prefetcher
+	void prefetch(vector<int> &ids);
 	HiMesh_Wrapper *get_mesh_wrapper(int id){
 		assert(id>=0&&id<objects.size());
 		return objects[id];
 	}
+	aab get_box(){
+		return box;
+	}
+	size_t get_origin(int id){
+		assert(id>=0&&id<objects.size());
+		return objects[id]->origin;
+	}
 	aab get_mbb(int id){
 		assert(id>=0&&id<objects.size());
 		return objects[id]->box.box;
@@ -65,6 +174,9 @@ public:
 	int num_objects(){
 		return objects.size();
 	}
+	size_t num_voxels(){
+		return voxel_count;
+	}
 	void set_capacity(size_t max_num_objects){
 		capacity = max_num_objects;
 	}
@@ -82,6 +194,13 @@ public:
 	}
 
 	OctreeNode *build_octree(size_t num_tiles);
+
+	// the objects with any voxel intersecting query_box, and the ones
+	// with any voxel within distance of point, their segments or
+	// triangles at lod are returned in result. Return false if
+	// some of them are not available at lod, see fetch
+	bool query(aab &query_box, int lod, enum data_type seg_tri, query_result &result);
+	bool query(float *point, float distance, int lod, enum data_type seg_tri, query_result &result);
 	//SpatialIndex::ISpatialIndex *build_rtree();
 
 };
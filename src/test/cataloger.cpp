@@ -0,0 +1,56 @@
+/*
+ * cataloger.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  generate the catalog of a dataset with
+ *  the given tiles or folders of tiles
+ */
+
+#include <boost/program_options.hpp>
+
+#include "../storage/catalog.h"
+
+using namespace std;
+using namespace hispeed;
+namespace po = boost::program_options;
+
+int main(int argc, char **argv){
+	string output_path;
+	vector<string> inputs;
+
+	po::options_description desc("cataloger usage");
+	desc.add_options()
+		("help,h", "produce help message")
+		("output,o", po::value<string>(&output_path)->required(), "path to the catalog")
+		("input,i", po::value<vector<string>>(&inputs)->multitoken()->required(), "the tiles or folders of tiles")
+		;
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	if (vm.count("help")) {
+		cout << desc << "\n";
+		return 0;
+	}
+	po::notify(vm);
+
+	struct timeval start = get_cur_time();
+	vector<string> files;
+	for(string &in:inputs){
+		hispeed::list_files(in.c_str(), files);
+	}
+	vector<tile_info> tiles;
+	for(string &f:files){
+		if(f.size()<3||f.compare(f.size()-3, 3, ".dt")!=0){
+			continue;
+		}
+		tile_info info;
+		if(describe_tile(f, info)){
+			tiles.push_back(info);
+		}
+	}
+	if(!persist_catalog(output_path.c_str(), tiles)){
+		return 1;
+	}
+	logt("%ld tiles are cataloged in %s", start, tiles.size(), output_path.c_str());
+	return 0;
+}
@@ -0,0 +1,216 @@
+/*
+ * checker.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  check the results of the progressive joins over tiles
+ *  against the joins evaluated at the top LOD only: the
+ *  within distance join, the k nearest neighbors with their
+ *  ties broken, and the symmetric intersection self join. The
+ *  approximate within join is checked against the exact ones
+ *  with and without the tolerance
+ */
+
+#include <boost/program_options.hpp>
+#include <vector>
+#include <map>
+
+#include "../join/SpatialJoin.h"
+
+using namespace std;
+using namespace hispeed;
+namespace po = boost::program_options;
+
+typedef pair<size_t, size_t> id_pair;
+
+string tile1_path;
+string tile2_path;
+size_t max_objects = LONG_MAX;
+// tile 1 is joined with itself if tile 2 is not given
+bool self_join = true;
+geometry_computer *gc = NULL;
+
+// run a join on the tiles loaded again, such that
+// no decoded data is left by the former runs. It is
+// approximate if the tolerance is positive
+vector<join_result> run_join(Join_Type type, bool self, bool exact, float distance, uint k, bool symmetric, float tolerance = 0){
+	Tile *tile1 = new Tile(tile1_path.c_str(), max_objects);
+	Tile *tile2 = tile1;
+	if(!self){
+		tile2 = new Tile(tile2_path.c_str(), max_objects);
+	}
+	SpatialJoin *joiner = new SpatialJoin(gc);
+	memory_sink *sink = new memory_sink();
+	joiner->set_sink(sink);
+	joiner->set_knn(k);
+	joiner->set_symmetric(symmetric);
+	joiner->set_tolerance(tolerance, 0);
+	if(exact){
+		joiner->set_base_lod(100);
+	}
+	vector<pair<Tile *, Tile *>> tile_pairs;
+	tile_pairs.push_back(pair<Tile *, Tile *>(tile1, tile2));
+	if(type==JT_intersect){
+		joiner->intersect_batch(tile_pairs, 1);
+	}else if(type==JT_distance){
+		joiner->within_batch(tile_pairs, 1, distance);
+	}else{
+		joiner->nearest_neighbor_batch(tile_pairs, 1, false);
+	}
+	sink->close();
+	vector<join_result> results = sink->results;
+	delete sink;
+	delete joiner;
+	if(tile2!=tile1){
+		delete tile2;
+	}
+	delete tile1;
+	return results;
+}
+
+vector<id_pair> get_pairs(const vector<join_result> &results){
+	vector<id_pair> pairs;
+	for(const join_result &r:results){
+		pairs.push_back(id_pair(r.id1, r.id2));
+	}
+	std::sort(pairs.begin(), pairs.end());
+	return pairs;
+}
+
+// the pairs in the results should be the same, each
+// pair is reported once
+bool check_pairs(const char *name, vector<join_result> &results, vector<join_result> &expected){
+	vector<id_pair> got = get_pairs(results);
+	vector<id_pair> truth = get_pairs(expected);
+	size_t duplicated = got.size();
+	got.erase(std::unique(got.begin(), got.end()), got.end());
+	duplicated -= got.size();
+	vector<id_pair> missing;
+	vector<id_pair> extra;
+	std::set_difference(truth.begin(), truth.end(), got.begin(), got.end(), std::back_inserter(missing));
+	std::set_difference(got.begin(), got.end(), truth.begin(), truth.end(), std::back_inserter(extra));
+	for(id_pair &p:extra){
+		log("%s: %ld-%ld is not expected", name, p.first, p.second);
+	}
+	for(id_pair &p:missing){
+		log("%s: %ld-%ld is missing", name, p.first, p.second);
+	}
+	bool ok = missing.empty()&&extra.empty()&&duplicated==0;
+	log("%s: %s, %ld pairs, %ld missing %ld not expected %ld duplicated", name, ok?"passed":"FAILED",
+			truth.size(), missing.size(), extra.size(), duplicated);
+	return ok;
+}
+
+// the pairs within the distance are found with the
+// distances of the lower LODs as well
+bool check_within(float distance){
+	vector<join_result> results = run_join(JT_distance, self_join, false, distance, 1, false);
+	vector<join_result> expected = run_join(JT_distance, self_join, true, distance, 1, false);
+	return check_pairs("within join", results, expected);
+}
+
+// the approximate within join reports all the pairs within the
+// distance, and none whose exact distance is over the distance
+// plus the tolerance
+bool check_approximate(float distance, float tolerance){
+	vector<id_pair> got = get_pairs(run_join(JT_distance, self_join, false, distance, 1, false, tolerance));
+	vector<id_pair> truth = get_pairs(run_join(JT_distance, self_join, true, distance, 1, false));
+	vector<id_pair> wide = get_pairs(run_join(JT_distance, self_join, true, distance+tolerance, 1, false));
+	vector<id_pair> missing;
+	vector<id_pair> extra;
+	std::set_difference(truth.begin(), truth.end(), got.begin(), got.end(), std::back_inserter(missing));
+	std::set_difference(got.begin(), got.end(), wide.begin(), wide.end(), std::back_inserter(extra));
+	for(id_pair &p:extra){
+		log("approximate within join: %ld-%ld is beyond the tolerance", p.first, p.second);
+	}
+	for(id_pair &p:missing){
+		log("approximate within join: %ld-%ld is missing", p.first, p.second);
+	}
+	bool ok = missing.empty()&&extra.empty();
+	log("approximate within join: %s, %ld pairs, %ld missing %ld beyond the tolerance", ok?"passed":"FAILED",
+			got.size(), missing.size(), extra.size());
+	return ok;
+}
+
+// at most k neighbors are reported for each object even with ties,
+// and their distances are the ones of the k nearest neighbors
+bool check_knn(uint k){
+	vector<join_result> results = run_join(JT_nearest, self_join, false, 0, k, false);
+	vector<join_result> expected = run_join(JT_nearest, self_join, true, 0, k, false);
+	map<size_t, vector<float>> got;
+	map<size_t, vector<float>> truth;
+	for(join_result &r:results){
+		got[r.id1].push_back(r.farthest);
+	}
+	for(join_result &r:expected){
+		truth[r.id1].push_back(r.farthest);
+	}
+	size_t failed = 0;
+	for(auto &t:truth){
+		vector<float> &dist = got[t.first];
+		std::sort(dist.begin(), dist.end());
+		std::sort(t.second.begin(), t.second.end());
+		bool ok = dist.size()<=k&&dist.size()==t.second.size();
+		for(size_t i=0;ok&&i<dist.size();i++){
+			ok = fabs(dist[i]-t.second[i])<=1e-3*std::max(t.second[i], (float)1);
+		}
+		if(!ok){
+			log("knn join: %ld has %ld neighbors, %ld expected", t.first, dist.size(), t.second.size());
+			failed++;
+		}
+	}
+	// the ones not expected at all
+	for(auto &g:got){
+		if(truth.find(g.first)==truth.end()){
+			log("knn join: %ld has %ld neighbors, none expected", g.first, g.second.size());
+			failed++;
+		}
+	}
+	log("knn join: %s, %ld objects %ld failed", failed==0?"passed":"FAILED", truth.size(), failed);
+	return failed==0;
+}
+
+// the symmetric self join reports the same pairs
+// as the join evaluating both orders
+bool check_symmetric(){
+	vector<join_result> results = run_join(JT_intersect, true, false, 0, 1, true);
+	vector<join_result> expected = run_join(JT_intersect, true, false, 0, 1, false);
+	return check_pairs("symmetric self join", results, expected);
+}
+
+int main(int argc, char **argv){
+	float distance = 1.0;
+	float tolerance = 0.1;
+	uint knn = 3;
+
+	po::options_description desc("checker usage");
+	desc.add_options()
+		("help,h", "produce help message")
+		("tile1", po::value<string>(&tile1_path)->required(), "path to tile 1")
+		("tile2", po::value<string>(&tile2_path), "path to tile 2, tile 1 is joined with itself by default")
+		("max_objects,m", po::value<size_t>(&max_objects), "max number of objects in a tile")
+		("distance", po::value<float>(&distance), "the distance of the within join")
+		("tolerance", po::value<float>(&tolerance), "the tolerance of the approximate within join")
+		("knn,k", po::value<uint>(&knn), "number of the nearest neighbors of each object")
+		;
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	if (vm.count("help")) {
+		cout << desc << "\n";
+		return 0;
+	}
+	po::notify(vm);
+	self_join = !vm.count("tile2");
+
+	gc = new geometry_computer();
+	size_t failed = 0;
+	failed += !check_within(distance);
+	if(tolerance>0){
+		failed += !check_approximate(distance, tolerance);
+	}
+	failed += !check_knn(knn);
+	failed += !check_symmetric();
+	delete gc;
+	log("%ld checks failed", failed);
+	return failed==0?0:1;
+}
@@ -0,0 +1,46 @@
+/*
+ * compactor.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  rewrite a tile with the objects clustered
+ *  along the Hilbert curve
+ */
+
+#include <boost/program_options.hpp>
+
+#include "../storage/tile.h"
+
+using namespace std;
+using namespace hispeed;
+namespace po = boost::program_options;
+
+int main(int argc, char **argv){
+	string input_path;
+	string output_path;
+	size_t block_size = 64;
+
+	po::options_description desc("compactor usage");
+	desc.add_options()
+		("help,h", "produce help message")
+		("input,i", po::value<string>(&input_path)->required(), "path to the input tile")
+		("output,o", po::value<string>(&output_path)->required(), "path to the output tile")
+		("block,b", po::value<size_t>(&block_size), "size of the blocks in KB, 0 for no alignment")
+		;
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	if (vm.count("help")) {
+		cout << desc << "\n";
+		return 0;
+	}
+	po::notify(vm);
+	if(input_path==output_path){
+		log("the output should not overwrite the input");
+		return 1;
+	}
+
+	Tile *tile = new Tile(input_path);
+	bool success = tile->rewrite(output_path, block_size<<10);
+	delete tile;
+	return success?0:1;
+}
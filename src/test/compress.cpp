@@ -22,6 +22,7 @@
 #include <queue>
 
 #include "../storage/tile.h"
+#include "../storage/meta.h"
 #include "../util/util.h"
 #include "../spatial/spatial.h"
 
@@ -40,10 +41,14 @@ pthread_mutex_t output_lock;
 bool stop = false;
 
 std::ofstream *os;
+// the metadata attached to the end of the output file
+meta_builder meta;
 inline void flush_mesh_buffer(vector<HiMesh *> &mesh_buffer, vector<vector<Voxel *>> &voxels){
 	assert(mesh_buffer.size()==voxels.size());
 	pthread_mutex_lock(&output_lock);
 	for(int i=0;i<mesh_buffer.size();i++){
+		size_t offset = os->tellp();
+		meta.add_object(offset+sizeof(size_t), mesh_buffer[i]->dataOffset, voxels[i]);
 		os->write((char *)&mesh_buffer[i]->dataOffset, sizeof(size_t));
 		os->write(mesh_buffer[i]->p_data, mesh_buffer[i]->dataOffset);
 		size_t size = voxels[i].size();
@@ -171,6 +176,11 @@ int main(int argc, char** argv) {
 		pthread_join(threads[i], &status);
 	}
 
+	// attach the metadata as the footer
+	size_t footer_size = 0;
+	char *footer = meta.serialize_footer(os->tellp(), footer_size);
+	os->write(footer, footer_size);
+	delete []footer;
 	os->flush();
 	os->close();
 	is.close();
@@ -11,6 +11,7 @@
 #include <boost/program_options.hpp>
 #include <fstream>
 #include "../spatial/himesh.h"
+#include "../storage/meta.h"
 
 using namespace hispeed;
 using namespace std;
@@ -182,11 +183,12 @@ Polyhedron shift_polyhedron(float shift[3], Polyhedron &poly_o){
  * generate the binary data for a polyhedron and its voxels
  * */
 inline void organize_data(Polyhedron &poly, vector<Voxel *> voxels,
-		float shift[3], char *data, size_t &offset){
+		float shift[3], char *data, size_t &offset, meta_builder &meta){
 	Polyhedron shifted = shift_polyhedron(shift, poly);
 	MyMesh *mesh = poly_to_mesh(shifted);
 	memcpy(data+offset, (char *)&mesh->dataOffset, sizeof(size_t));
 	offset += sizeof(size_t);
+	meta.add_object(offset, mesh->dataOffset, voxels, shift);
 	memcpy(data+offset, mesh->p_data, mesh->dataOffset);
 	offset += mesh->dataOffset;
 	size_t size = voxels.size();
@@ -221,7 +223,8 @@ inline void organize_data(Polyhedron &poly, vector<Voxel *> voxels,
  * a given shift base
  *
  * */
-inline int generate_nuclei(float base[3], char *data, size_t &offset, char *data2, size_t &offset2){
+inline int generate_nuclei(float base[3], char *data, size_t &offset, meta_builder &meta,
+		char *data2, size_t &offset2, meta_builder &meta2){
 	int nuclei_num[3];
 	for(int i=0;i<3;i++){
 		nuclei_num[i] = (int)(vessel_box.max[i]/nuclei_box.max[i]);
@@ -239,10 +242,10 @@ inline int generate_nuclei(float base[3], char *data, size_t &offset, char *data
 				shift[1] = j*nuclei_box.max[1]+base[1];
 				shift[2] = k*nuclei_box.max[2]+base[2];
 				int polyid = hispeed::get_rand_number(nucleis.size()-1);
-				organize_data(nucleis[polyid], nucleis_voxels[polyid], shift, data, offset);
+				organize_data(nucleis[polyid], nucleis_voxels[polyid], shift, data, offset, meta);
 				{
 					int polyid2 = hispeed::get_rand_number(nucleis.size()-1);
-					organize_data(nucleis[polyid], nucleis_voxels[polyid2], shift, data2, offset2);
+					organize_data(nucleis[polyid], nucleis_voxels[polyid2], shift, data2, offset2, meta2);
 				}
 				generated++;
 			}
@@ -253,6 +256,9 @@ inline int generate_nuclei(float base[3], char *data, size_t &offset, char *data
 
 ofstream *os = NULL;
 ofstream *os2 = NULL;
+// the metadata attached to the end of the output files
+meta_builder global_meta;
+meta_builder global_meta2;
 queue<tuple<float, float, float>> jobs;
 pthread_mutex_t mylock;
 long global_generated = 0;
@@ -271,10 +277,14 @@ void *generate_unit(void *arg){
 		pthread_mutex_unlock(&mylock);
 		size_t offset = 0;
 		size_t offset2 = 0;
+		meta_builder meta;
+		meta_builder meta2;
 		float base[3] = {get<0>(job),get<1>(job),get<2>(job)};
-		int generated = generate_nuclei(base, data, offset, data2, offset2);
+		int generated = generate_nuclei(base, data, offset, meta, data2, offset2, meta2);
 
 		pthread_mutex_lock(&mylock);
+		global_meta.append(meta, os->tellp());
+		global_meta2.append(meta2, os2->tellp());
 		os->write(data, offset);
 		os2->write(data2, offset2);
 		global_generated += generated;
@@ -285,17 +295,27 @@ void *generate_unit(void *arg){
 	return NULL;
 }
 
+// attach the metadata as the footer of the data file
+void write_footer(ofstream *out, meta_builder &meta){
+	size_t footer_size = 0;
+	char *footer = meta.serialize_footer(out->tellp(), footer_size);
+	out->write(footer, footer_size);
+	delete []footer;
+}
+
 void generate_vessel(const char *path, vector<tuple<float, float, float>> &vessel_shifts, int voxel_size){
 	char *data = new char[vessel_shifts.size()*100000*2];
 	size_t offset = 0;
+	meta_builder meta;
 	HiMesh *himesh = poly_to_himesh(vessel);
 	vector<Voxel *> voxels = himesh->generate_voxels(voxel_size);
 	for(tuple<float, float, float> tp:vessel_shifts){
 		float shift[3] = {get<0>(tp),get<1>(tp),get<2>(tp)};
-		organize_data(vessel, voxels, shift, data, offset);
+		organize_data(vessel, voxels, shift, data, offset, meta);
 	}
 	ofstream *v_os = new std::ofstream(path, std::ios::out | std::ios::binary);
 	v_os->write(data, offset);
+	write_footer(v_os, meta);
 	v_os->close();
 	delete v_os;
 	log("%d voxels are generated for the vessel",voxels.size());
@@ -383,6 +403,8 @@ int main(int argc, char **argv){
 		void *status;
 		pthread_join(threads[i], &status);
 	}
+	write_footer(os, global_meta);
+	write_footer(os2, global_meta2);
 	os->close();
 	os2->close();
 	logt("%ld nucleis are generated for %d vessels", start, global_generated, x_dim*y_dim*z_dim);
@@ -22,7 +22,9 @@ int main(int argc, char **argv){
 	string tile1_path("nuclei_tmp.dt");
 	string tile2_path("nuclei_tmp.dt");
 	bool intersect = false;
+	bool within = false;
 	bool ispeed = false;
+	bool use_mmap = false;
 	int num_threads = hispeed::get_num_threads();
 	int num_repeat_threads = hispeed::get_num_threads();
 
@@ -31,12 +33,30 @@ int main(int argc, char **argv){
 	int lod_gap = 50;
 	int top_lod = 100;
 	int repeated = 1;
+	size_t cache_size = 0;
+	int num_io_threads = 0;
+	size_t window_size = 0;
+	int pipeline_threads = 0;
+	uint knn = 1;
+	size_t small_mesh_size = 1<<14;
+	string dataset1_path;
+	string dataset2_path;
+	float distance = 0;
+	size_t max_idle = 16;
+	string output_path;
+	string output_format("csv");
+	float abs_tolerance = 0;
+	float rel_tolerance = 0;
+	size_t batch_pairs = 0;
+	int batch_wait = 1000;
 
 	po::options_description desc("joiner usage");
 	desc.add_options()
 		("help,h", "produce help message")
 		("gpu,g", "compute with GPU")
 		("intersect,i", "do intersection instead of join")
+		("knn,k", po::value<uint>(&knn), "number of the nearest neighbors of each object")
+		("within,w", "join the pairs within the distance given by --distance")
 		("tile1", po::value<string>(&tile1_path), "path to tile 1")
 		("tile2", po::value<string>(&tile2_path), "path to tile 2")
 		("threads,n", po::value<int>(&num_threads), "number of threads")
@@ -49,6 +69,25 @@ int main(int argc, char **argv){
 		("lod", po::value<std::vector<std::string>>()->multitoken()->
 		        zero_tokens()->composing(), "the lods need be processed")
 		("ispeed", "run in ispeed mode")
+		("mmap", "map the tiles into memory and decode in place")
+		("cache,c", po::value<size_t>(&cache_size), "size of the decoded mesh cache in MB")
+		("prefetch", po::value<int>(&num_io_threads), "number of threads for prefetching the compressed data")
+		("share", "share the decoded data among tiles of the same file")
+		("window", po::value<size_t>(&window_size), "join in windows of the given number of objects")
+		("adaptive", "schedule the lods for each candidate")
+		("symmetric", "evaluate each pair once in the intersection self join")
+		("tolerance", po::value<float>(&abs_tolerance), "stop refining a pair once its distance is known within this error")
+		("relative_tolerance", po::value<float>(&rel_tolerance), "stop refining a pair once its distance is known within this ratio of error")
+		("small_mesh", po::value<size_t>(&small_mesh_size), "size in bytes of the meshes decoded to the top lod directly")
+		("pipeline", po::value<int>(&pipeline_threads), "number of threads decoding the next lod while computing")
+		("batch_pairs", po::value<size_t>(&batch_pairs), "coalesce the geometry computations of the tile pairs until this number of pairs")
+		("batch_wait", po::value<int>(&batch_wait), "max microseconds waiting for the computations to be coalesced")
+		("dataset1", po::value<string>(&dataset1_path), "path to the catalog of dataset 1, joined with --intersect or --within")
+		("dataset2", po::value<string>(&dataset2_path), "path to the catalog of dataset 2")
+		("distance", po::value<float>(&distance), "the distance for --within, and for pairing the tiles of the datasets")
+		("max_idle", po::value<size_t>(&max_idle), "max number of idle tiles kept open for each dataset")
+		("output,o", po::value<string>(&output_path), "path to the file the results are written into")
+		("format", po::value<string>(&output_format), "format of the results, csv or binary")
 		;
 	po::variables_map vm;
 	po::store(po::parse_command_line(argc, argv, desc), vm);
@@ -66,12 +105,30 @@ int main(int argc, char **argv){
 	if(vm.count("intersect")){
 		intersect = true;
 	}
+	if(vm.count("within")){
+		within = true;
+	}
 	if(vm.count("ispeed")){
 		ispeed = true;
+		if(knn>1){
+			cout << "ispeed mode finds one nearest neighbor only\n";
+			return 0;
+		}
+	}
+	// the nearest neighbors are not merged across the tiles
+	if(vm.count("dataset1")&&!intersect&&!within){
+		cout << "datasets can only be joined with --intersect or --within\n";
+		return 1;
+	}
+	if(vm.count("mmap")){
+		use_mmap = true;
 	}
 	if(vm.count("threads")&&num_threads>0){
 		gc->set_thread_num(num_threads);
 	}
+	if(vm.count("batch_pairs")){
+		gc->set_batching(batch_pairs, batch_wait);
+	}
 
 
 	SpatialJoin *joiner = new SpatialJoin(gc);
@@ -84,6 +141,25 @@ int main(int argc, char **argv){
 	if(vm.count("top_lod")){
 		joiner->set_top_lod(top_lod);
 	}
+	if(vm.count("window")){
+		joiner->set_window_size(window_size);
+	}
+	if(vm.count("knn")){
+		joiner->set_knn(knn);
+	}
+	if(vm.count("adaptive")){
+		joiner->set_adaptive_lod(true);
+		joiner->set_small_mesh_size(small_mesh_size);
+	}
+	if(vm.count("tolerance")||vm.count("relative_tolerance")){
+		joiner->set_tolerance(abs_tolerance, rel_tolerance);
+	}
+	if(vm.count("symmetric")){
+		joiner->set_symmetric(true);
+	}
+	if(vm.count("pipeline")){
+		joiner->set_pipeline_threads(pipeline_threads);
+	}
 	if(vm.count("lod")){
 		vector<int> lods;
 		for(string l:vm["lod"].as<std::vector<std::string>>()){
@@ -92,28 +168,110 @@ int main(int argc, char **argv){
 		joiner->set_lods(lods);
 	}
 
+	result_sink *sink = NULL;
+	if(vm.count("output")){
+		if(output_format=="binary"){
+			sink = new binary_sink(output_path);
+		}else if(output_format=="csv"){
+			sink = new csv_sink(output_path);
+		}else{
+			cout << "unknown format " << output_format << "\n";
+			return 0;
+		}
+		joiner->set_sink(sink);
+	}
+
+	mesh_cache *cache = NULL;
+	if(vm.count("cache")&&cache_size>0){
+		cache = new mesh_cache(cache_size<<20);
+	}
+	prefetcher *fetcher = NULL;
+	if(vm.count("prefetch")&&num_io_threads>0){
+		fetcher = new prefetcher(num_io_threads);
+	}
+	job_sharing *sharing = NULL;
+	if(vm.count("share")){
+		sharing = new job_sharing();
+	}
+
+	// join the whole datasets, the tiles are opened on demand
+	if(vm.count("dataset1")){
+		Dataset *ds1 = new Dataset(dataset1_path.c_str(), use_mmap);
+		Dataset *ds2 = ds1;
+		if(vm.count("dataset2")){
+			ds2 = new Dataset(dataset2_path.c_str(), use_mmap);
+		}
+		for(Dataset *ds:{ds1, ds2}){
+			ds->set_max_idle(max_idle);
+			ds->set_cache(cache);
+			ds->set_prefetcher(fetcher);
+			ds->set_sharing(sharing);
+		}
+		Join_Type type = intersect?JT_intersect:(within?JT_distance:JT_nearest);
+		joiner->join_dataset(ds1, ds2, type, distance, num_repeat_threads);
+		double join_time = hispeed::get_time_elapsed(start,false);
+		logt("join", start);
+		joiner->report_time(join_time);
+		ds1->report();
+		if(ds2!=ds1){
+			ds2->report();
+			delete ds2;
+		}
+		delete ds1;
+	}
+
 	vector<pair<Tile *, Tile *>> tile_pairs;
-	for(int i=0;i<repeated;i++){
-		Tile *tile1 = new Tile(tile1_path.c_str(), max_objects);
+	for(int i=0;i<repeated&&!vm.count("dataset1");i++){
+		Tile *tile1 = new Tile(tile1_path.c_str(), max_objects, use_mmap);
 		Tile *tile2 = tile1;
 		if(vm.count("tile2")){
-			tile2 = new Tile(tile2_path.c_str(), max_objects);
+			tile2 = new Tile(tile2_path.c_str(), max_objects, use_mmap);
 		}
 		assert(tile1&&tile2);
+		tile1->set_tag(i);
+		tile2->set_tag(i);
+		tile1->set_cache(cache);
+		tile2->set_cache(cache);
+		tile1->set_prefetcher(fetcher);
+		tile2->set_prefetcher(fetcher);
+		tile1->set_sharing(sharing);
+		tile2->set_sharing(sharing);
 		tile_pairs.push_back(pair<Tile *, Tile *>(tile1, tile2));
 	}
 	logt("load tiles", start);
 
-	if(intersect){
-		joiner->intersect_batch(tile_pairs, num_repeat_threads);
-	}else{
-		joiner->nearest_neighbor_batch(tile_pairs, num_repeat_threads, ispeed);
+	if(tile_pairs.size()>0){
+		if(intersect){
+			joiner->intersect_batch(tile_pairs, num_repeat_threads);
+		}else if(within){
+			joiner->within_batch(tile_pairs, num_repeat_threads, distance);
+		}else{
+			joiner->nearest_neighbor_batch(tile_pairs, num_repeat_threads, ispeed);
+		}
+		double join_time = hispeed::get_time_elapsed(start,false);
+		logt("join", start);
+		tile_pairs.clear();
+		joiner->report_time(join_time);
+	}
+	if(sink){
+		sink->close();
+		sink->report();
+		delete sink;
+	}
+	if(cache){
+		cache->report();
+		delete cache;
+	}
+	if(fetcher){
+		fetcher->report();
+		delete fetcher;
+	}
+	if(sharing){
+		sharing->report();
+		delete sharing;
 	}
-	double join_time = hispeed::get_time_elapsed(start,false);
-	logt("join", start);
-	tile_pairs.clear();
-	joiner->report_time(join_time);
 	delete joiner;
+	gc->report();
 	delete gc;
 	logt("cleaning", start);
 
@@ -0,0 +1,89 @@
+/*
+ * querier.cpp
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  fetch the segments or triangles of the objects in a tile
+ *  intersecting a box, or within a distance of a point, at
+ *  the given LOD
+ */
+
+#include <boost/program_options.hpp>
+
+#include "../storage/tile.h"
+
+using namespace std;
+using namespace hispeed;
+namespace po = boost::program_options;
+
+int main(int argc, char **argv){
+	string tile_path;
+	vector<float> box;
+	vector<float> point;
+	float distance = 0;
+	int lod = 100;
+	size_t cache_size = 0;
+	bool use_mmap = false;
+
+	po::options_description desc("querier usage");
+	desc.add_options()
+		("help,h", "produce help message")
+		("tile", po::value<string>(&tile_path)->required(), "path to the tile")
+		("box", po::value<vector<float>>(&box)->multitoken(), "the box queried, as min_x min_y min_z max_x max_y max_z")
+		("point", po::value<vector<float>>(&point)->multitoken(), "the point queried, as x y z")
+		("distance", po::value<float>(&distance), "the distance to the point queried")
+		("lod", po::value<int>(&lod), "the lod of the data fetched")
+		("triangle", "fetch the triangles instead of the segments")
+		("cache,c", po::value<size_t>(&cache_size), "size of the decoded mesh cache in MB")
+		("mmap", "map the tile into memory and decode in place")
+		;
+	po::variables_map vm;
+	po::store(po::parse_command_line(argc, argv, desc), vm);
+	if (vm.count("help")) {
+		cout << desc << "\n";
+		return 0;
+	}
+	po::notify(vm);
+	if(vm.count("box")==vm.count("point")){
+		cout << "either --box or --point should be given\n";
+		return 1;
+	}
+	if((vm.count("box")&&box.size()!=6)||(vm.count("point")&&point.size()!=3)){
+		cout << "a box takes 6 values and a point takes 3\n";
+		return 1;
+	}
+	if(vm.count("mmap")){
+		use_mmap = true;
+	}
+	enum data_type seg_tri = vm.count("triangle")?DT_Triangle:DT_Segment;
+
+	struct timeval start = get_cur_time();
+	Tile *tile = new Tile(tile_path.c_str(), LONG_MAX, use_mmap);
+	mesh_cache *cache = NULL;
+	if(vm.count("cache")&&cache_size>0){
+		cache = new mesh_cache(cache_size<<20);
+		tile->set_cache(cache);
+	}
+	logt("load tile", start);
+
+	query_result result;
+	bool complete;
+	if(vm.count("box")){
+		aab query_box(box[0], box[1], box[2], box[3], box[4], box[5]);
+		complete = tile->query(query_box, lod, seg_tri, result);
+	}else{
+		complete = tile->query(point.data(), distance, lod, seg_tri, result);
+	}
+	logt("%ld objects with %ld %s fetched at lod %d", start, result.num_objects(),
+			result.num_data(), seg_tri==DT_Segment?"segments":"triangles", lod);
+	for(int id:result.failed){
+		log("object %d is not available at lod %d", id, lod);
+	}
+
+	delete tile;
+	if(cache){
+		cache->report();
+		delete cache;
+	}
+	return complete?0:1;
+}
@@ -0,0 +1,205 @@
+/*
+ * task_pool.cpp
+ *
+ *  Created on: Oct 17, 2026
+ */
+
+#include "task_pool.h"
+#include "util.h"
+
+namespace hispeed{
+
+// the pool and queue index of the current worker thread
+static __thread task_pool *current_pool = NULL;
+static __thread int current_index = -1;
+
+typedef struct worker_param_{
+	task_pool *pool;
+	int index;
+}worker_param;
+
+task_pool::task_pool(int num_threads){
+	assert(num_threads>0);
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&cond, NULL);
+	pthread_mutex_init(&coarse.lock, NULL);
+	for(int i=0;i<=num_threads;i++){
+		task_queue *q = new task_queue();
+		pthread_mutex_init(&q->lock, NULL);
+		queues.push_back(q);
+	}
+	threads.resize(num_threads);
+	for(int i=0;i<num_threads;i++){
+		worker_param *param = new worker_param();
+		param->pool = this;
+		param->index = i;
+		pthread_create(&threads[i], NULL, work, (void *)param);
+	}
+}
+
+task_pool::~task_pool(){
+	pthread_mutex_lock(&lock);
+	stop = true;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+	for(pthread_t &t:threads){
+		void *status;
+		pthread_join(t, &status);
+	}
+	for(task_queue *q:queues){
+		assert(q->tasks.empty());
+		delete q;
+	}
+	queues.clear();
+}
+
+int task_pool::self(){
+	if(current_pool==this){
+		return current_index;
+	}
+	return queues.size()-1;
+}
+
+void task_pool::push(task_queue *q, task &t, volatile long *counter){
+	__sync_fetch_and_add(&t.group->pending, 1);
+	// counted before being queued, such that the counter
+	// never falls below the number of queued tasks
+	__sync_fetch_and_add(counter, 1);
+	pthread_mutex_lock(&q->lock);
+	q->tasks.push_back(t);
+	pthread_mutex_unlock(&q->lock);
+	pthread_mutex_lock(&lock);
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&lock);
+}
+
+void task_pool::submit(task_group &group, task_func func, void *arg, bool is_coarse){
+	task t;
+	t.func = func;
+	t.arg = arg;
+	t.group = &group;
+	if(is_coarse){
+		push(&coarse, t, &queued_coarse);
+	}else{
+		push(queues[self()], t, &queued);
+	}
+}
+
+bool task_pool::pop(task_queue *q, bool back, task &t){
+	pthread_mutex_lock(&q->lock);
+	if(q->tasks.empty()){
+		pthread_mutex_unlock(&q->lock);
+		return false;
+	}
+	if(back){
+		t = q->tasks.back();
+		q->tasks.pop_back();
+	}else{
+		t = q->tasks.front();
+		q->tasks.pop_front();
+	}
+	pthread_mutex_unlock(&q->lock);
+	return true;
+}
+
+bool task_pool::take(bool with_coarse, task &t){
+	const int me = self();
+	// the latest one in its own queue, which is likely
+	// to share the data cached by the last task
+	if(pop(queues[me], true, t)){
+		__sync_fetch_and_sub(&queued, 1);
+		return true;
+	}
+	// steal the oldest one from the others
+	for(size_t i=1;i<queues.size();i++){
+		if(pop(queues[(me+i)%queues.size()], false, t)){
+			__sync_fetch_and_sub(&queued, 1);
+			__sync_fetch_and_add(&stolen, 1);
+			return true;
+		}
+	}
+	if(with_coarse&&pop(&coarse, false, t)){
+		__sync_fetch_and_sub(&queued_coarse, 1);
+		return true;
+	}
+	return false;
+}
+
+void task_pool::run(task &t){
+	t.func(t.arg);
+	__sync_fetch_and_add(&executed, 1);
+	if(__sync_sub_and_fetch(&t.group->pending, 1)==0){
+		// wake up the threads waiting for this group
+		pthread_mutex_lock(&lock);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+void *task_pool::work(void *arg){
+	worker_param *param = (worker_param *)arg;
+	task_pool *pool = param->pool;
+	current_pool = pool;
+	current_index = param->index;
+	delete param;
+	task t;
+	while(true){
+		if(pool->take(true, t)){
+			pool->run(t);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		while(!pool->stop&&pool->queued==0&&pool->queued_coarse==0){
+			pthread_cond_wait(&pool->cond, &pool->lock);
+		}
+		bool stopped = pool->stop&&pool->queued==0&&pool->queued_coarse==0;
+		pthread_mutex_unlock(&pool->lock);
+		if(stopped){
+			break;
+		}
+	}
+	return NULL;
+}
+
+void task_pool::wait(task_group &group){
+	task t;
+	while(!group.done()){
+		if(take(false, t)){
+			run(t);
+			continue;
+		}
+		// the rest are running in other threads
+		pthread_mutex_lock(&lock);
+		while(!group.done()&&queued==0){
+			pthread_cond_wait(&cond, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+void task_pool::hold(task_group &group){
+	__sync_fetch_and_add(&group.pending, 1);
+}
+
+void task_pool::release(task_group &group){
+	if(__sync_sub_and_fetch(&group.pending, 1)==0){
+		pthread_mutex_lock(&lock);
+		pthread_cond_broadcast(&cond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+bool task_pool::help(){
+	task t;
+	if(take(false, t)){
+		run(t);
+		return true;
+	}
+	return false;
+}
+
+void task_pool::report(){
+	log("task pool: %ld threads %ld tasks executed %ld stolen", threads.size(), executed, stolen);
+}
+
+}
@@ -0,0 +1,100 @@
+/*
+ * task_pool.h
+ *
+ *  Created on: Oct 17, 2026
+ *
+ *  a pool of worker threads executing tasks with work
+ *  stealing. Each worker takes the latest task from its
+ *  own queue, and steals the oldest ones from the others
+ *  when it runs out. The tasks are routines of the same
+ *  form as the pthread routines, such that the units run
+ *  by pthread_create can be submitted directly.
+ *
+ *  The fine grained tasks (decoding, packing, geometry
+ *  kernels) are run by both the idle workers and the
+ *  threads waiting for a group. The coarse tasks (joining
+ *  a tile pair) are only taken by the idle workers, such
+ *  that a thread waiting for its kernels never nests
+ *  another join in its stack.
+ *
+ */
+
+#ifndef HISPEED_TASK_POOL_H_
+#define HISPEED_TASK_POOL_H_
+
+#include <pthread.h>
+#include <deque>
+#include <vector>
+
+using namespace std;
+
+namespace hispeed{
+
+typedef void *(*task_func)(void *);
+
+// a group of tasks waited together
+class task_group{
+public:
+	volatile long pending = 0;
+	bool done(){
+		return pending==0;
+	}
+};
+
+class task_pool{
+	typedef struct task_{
+		task_func func;
+		void *arg;
+		task_group *group;
+	}task;
+
+	typedef struct task_queue_{
+		pthread_mutex_t lock;
+		deque<task> tasks;
+	}task_queue;
+
+	// one queue for each worker, and the last one for
+	// the tasks submitted by the threads out of the pool
+	vector<task_queue *> queues;
+	task_queue coarse;
+	vector<pthread_t> threads;
+	// for the workers and the waiting threads to sleep
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	volatile long queued = 0;
+	volatile long queued_coarse = 0;
+	bool stop = false;
+
+	static void *work(void *arg);
+	// index of the queue of the current thread
+	int self();
+	bool pop(task_queue *q, bool back, task &t);
+	// take a fine grained task, or a coarse one if coarse is true
+	bool take(bool with_coarse, task &t);
+	void run(task &t);
+	void push(task_queue *q, task &t, volatile long *counter);
+public:
+	size_t executed = 0;
+	size_t stolen = 0;
+
+	task_pool(int num_threads);
+	~task_pool();
+	int num_threads(){
+		return threads.size();
+	}
+	void submit(task_group &group, task_func func, void *arg, bool is_coarse=false);
+	// wait for all the tasks in group, the waiting thread
+	// runs the fine grained tasks in the meantime
+	void wait(task_group &group);
+	// count a piece of work done out of the pool in group,
+	// which is waited until it is released
+	void hold(task_group &group);
+	void release(task_group &group);
+	// run a fine grained task if any, return false if none
+	bool help();
+	void report();
+};
+
+}
+
+#endif /* HISPEED_TASK_POOL_H_ */
@@ -3,6 +3,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <assert.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -157,6 +158,56 @@ inline bool file_exist(const char *path) {
   return (stat(path, &buffer) == 0);
 }
 
+inline time_t file_mtime(const char *path){
+	struct stat buffer;
+	return stat(path, &buffer)==0?buffer.st_mtime:0;
+}
+
+/*
+ * the index of the point on a 3D Hilbert curve of given order,
+ * each coordinate takes bits(<=21) bits. Following Skilling's
+ * "Programming the Hilbert curve" (AIP 2004)
+ * */
+inline uint64_t hilbert_key(uint32_t x, uint32_t y, uint32_t z, int bits){
+	assert(bits>0&&bits<=21);
+	uint32_t X[3] = {x, y, z};
+	const uint32_t M = 1u<<(bits-1);
+	// inverse undo
+	for(uint32_t Q=M;Q>1;Q>>=1){
+		uint32_t P = Q-1;
+		for(int i=0;i<3;i++){
+			if(X[i]&Q){
+				X[0] ^= P;
+			}else{
+				uint32_t t = (X[0]^X[i])&P;
+				X[0] ^= t;
+				X[i] ^= t;
+			}
+		}
+	}
+	// gray encode
+	for(int i=1;i<3;i++){
+		X[i] ^= X[i-1];
+	}
+	uint32_t t = 0;
+	for(uint32_t Q=M;Q>1;Q>>=1){
+		if(X[2]&Q){
+			t ^= Q-1;
+		}
+	}
+	for(int i=0;i<3;i++){
+		X[i] ^= t;
+	}
+	// interleave the transposed bits
+	uint64_t key = 0;
+	for(int b=bits-1;b>=0;b--){
+		for(int i=0;i<3;i++){
+			key = (key<<1)|((X[i]>>b)&1);
+		}
+	}
+	return key;
+}
+
 inline int get_num_threads(){
 	return std::thread::hardware_concurrency();
 }